@@ -0,0 +1,157 @@
+#include "Autotuner.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <memory>
+
+#include "BMPio.h"
+#include "Filter.h"
+#include "Parallel.h"
+#include "Pipeline.h"
+#include "TiledExecutor.h"
+
+namespace {
+// a gradient with noise, in the 8-bit levels files have, so that no filter finds the image flat
+std::vector<std::vector<Image::Pixel>> MakeGrid(size_t height, size_t width) {
+    std::vector<std::vector<Image::Pixel>> grid(height, std::vector<Image::Pixel>(width));
+    uint32_t state = 2463534242u;
+    auto noise = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return static_cast<long double>(state % 64);
+    };
+    for (size_t x = 0; x < height; ++x) {
+        for (size_t y = 0; y < width; ++y) {
+            long double red = static_cast<long double>(x * 191 / std::max<size_t>(height, 1)) + noise();
+            long double green = static_cast<long double>(y * 191 / std::max<size_t>(width, 1)) + noise();
+            long double blue = static_cast<long double>((x + y) * 95 / std::max<size_t>(height + width, 1)) + noise();
+            grid[x][y] = Image::Pixel(red / Image::Pixel::DEPTH, green / Image::Pixel::DEPTH,
+                                      blue / Image::Pixel::DEPTH);
+        }
+    }
+    return grid;
+}
+
+long double Milliseconds(long double nanoseconds) {
+    return nanoseconds / 1e6L;
+}
+}  // namespace
+
+Autotuner::Autotuner(std::ostream& log, size_t height, size_t width) : log_(log), image_(MakeGrid(height, width)) {
+    gray_ = image_;
+    GrayscaleFilter{}(gray_);
+}
+
+long double Autotuner::Time(const Image& image, const std::function<void(Image&)>& body) {
+    long double best = std::numeric_limits<long double>::infinity();
+    for (size_t i = 0; i < REPETITIONS; ++i) {
+        Image copy = image;
+        auto start = std::chrono::steady_clock::now();
+        body(copy);
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<long double, std::nano>(end - start).count());
+    }
+    return best;
+}
+
+void Autotuner::Pick(const char* name, size_t Tuning::*parameter, const std::vector<size_t>& candidates,
+                     const std::function<long double()>& benchmark, Tuning& tuning) const {
+    log_ << std::left << std::setw(14) << name << std::right;
+    tuning.*parameter = 0;
+    Tuning::Set(tuning);
+    long double default_time = benchmark();
+    log_ << " default " << Milliseconds(default_time) << " ms";
+    long double best = default_time;
+    size_t picked = 0;
+    for (size_t candidate : candidates) {
+        tuning.*parameter = candidate;
+        Tuning::Set(tuning);
+        long double time = benchmark();
+        log_ << ", " << candidate << ' ' << Milliseconds(time) << " ms";
+        if (time < best && time < default_time * (1 - MIN_GAIN)) {
+            best = time;
+            picked = candidate;
+        }
+    }
+    tuning.*parameter = picked;
+    Tuning::Set(tuning);
+    log_ << "; picked ";
+    if (picked == 0) {
+        log_ << "the default\n";
+    } else {
+        log_ << picked << '\n';
+    }
+}
+
+Tuning Autotuner::operator()() const {
+    Tuning tuning;
+    Tuning::Set(tuning);
+    log_ << std::fixed << std::setprecision(1) << "tuning on " << image_.GetWidth() << 'x' << image_.GetHeight()
+         << " images, the fastest of " << REPETITIONS << " runs each\n";
+
+    GaussianFilter blur(2);
+    Pipeline tiled({FilterSpec::Sharpening(), FilterSpec::Negative(), FilterSpec::Sharpening()});
+    auto codec = [](Image& image) {
+        std::vector<unsigned char> data;
+        WriteBMP()(image, data);
+        ReadBMP()(data.data(), data.size(), image);
+    };
+
+    // the default, all the hardware threads, runs first, so the pool starts with all of them
+    size_t hardware = GetThreadCount();
+    std::vector<size_t> threads;
+    for (size_t count = hardware / 2; count >= 1; count /= 2) {
+        threads.push_back(count);
+    }
+    if (threads.empty()) {
+        log_ << std::left << std::setw(14) << "threads" << std::right << " only one hardware thread\n";
+    } else {
+        Pick("threads", &Tuning::threads, threads, [&]() {
+            return Time(image_, blur) + Time(image_, [&tiled](Image& image) { tiled(image); }) + Time(image_, codec);
+        }, tuning);
+    }
+
+    Pick("band_grain", &Tuning::band_grain, {8, 16, 64, 128}, [&]() {
+        return Time(image_, blur) + Time(gray_, blur);
+    }, tuning);
+
+    if (GetThreadCount() < 2) {
+        log_ << std::left << std::setw(14) << "tile_size" << std::right << " not used with one thread\n";
+    } else {
+        Pick("tile_size", &Tuning::tile_size, {64, 256, 512}, [&]() {
+            return Time(image_, [&tiled](Image& image) { tiled(image); });
+        }, tuning);
+    }
+
+    Pick("io_block_size", &Tuning::io_block_size, {1 << 16, 1 << 18, 1 << 22}, [&]() {
+        return Time(image_, codec);
+    }, tuning);
+
+    // the estimates of the filters against their times give the speed of the machine for -deadline
+    std::vector<std::pair<const char*, std::unique_ptr<Filter>>> filters;
+    filters.emplace_back("-blur 2", std::make_unique<GaussianFilter>(2));
+    filters.emplace_back("-sharp", std::make_unique<SharpeningFilter>());
+    filters.emplace_back("-neg", std::make_unique<NegativeFilter>());
+    filters.emplace_back("-gs", std::make_unique<GrayscaleFilter>());
+    long double estimated = 0;
+    long double measured = 0;
+    for (const Image* image : {&image_, &gray_}) {
+        for (const auto& [name, filter] : filters) {
+            long double cost = filter->GetCost(image->GetHeight(), image->GetWidth(), image->GetFormat());
+            long double time = Time(*image, [&filter](Image& copy) { (*filter)(copy); });
+            log_ << std::left << std::setw(14) << name << std::right << ' '
+                 << (image->IsGray() ? "GRAY " : "RGB  ") << Milliseconds(time) << " ms, estimated "
+                 << Milliseconds(cost) << " ms\n";
+            estimated += cost;
+            measured += time;
+        }
+    }
+    tuning.speed = measured == 0 ? 1 : estimated / measured;
+    Tuning::Set(tuning);
+    log_ << std::left << std::setw(14) << "speed" << std::right << ' ' << std::setprecision(2) << tuning.speed
+         << " times the reference machine\n";
+    return tuning;
+}
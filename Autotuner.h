@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+#include "Image.h"
+#include "Tuning.h"
+
+// --tune: times the Gaussian blur, the sharpening MatrixFilter, the point filters and the BMP codec on synthetic
+// images under the candidate values of one Tuning parameter at a time, with the values already picked for the ones
+// before it, and keeps the fastest. A candidate only replaces the default if it is clearly faster, so noise does not
+// move the parameters. The times of the filters against their Filter::GetCost() then give the speed of the machine.
+// Every time is the fastest of a few runs, which leaves out the runs other processes disturbed.
+class Autotuner {
+private:
+    inline static const size_t REPETITIONS = 3;
+    // how much faster than the default a candidate has to be to replace it
+    inline static const long double MIN_GAIN = 0.03;
+    std::ostream& log_;
+    Image image_;
+    Image gray_;
+
+    // nanoseconds of the fastest of REPETITIONS runs of body on copies of the image
+    static long double Time(const Image& image, const std::function<void(Image&)>& body);
+
+    // tries the candidates for the parameter, the default first, and leaves the fastest in tuning and in effect
+    void Pick(const char* name, size_t Tuning::*parameter, const std::vector<size_t>& candidates,
+              const std::function<long double()>& benchmark, Tuning& tuning) const;
+
+public:
+    inline static const size_t DEFAULT_HEIGHT = 512;
+    inline static const size_t DEFAULT_WIDTH = 768;
+
+    // logs every time measured; the pool of threads must not have started yet, so that it starts with all the
+    // hardware threads
+    explicit Autotuner(std::ostream& log, size_t height = DEFAULT_HEIGHT, size_t width = DEFAULT_WIDTH);
+
+    // tunes from the defaults and leaves the result in effect
+    Tuning operator()() const;
+};
@@ -0,0 +1,61 @@
+#include "AuxiliaryImages.h"
+
+#include <sys/stat.h>
+
+#include <filesystem>
+
+#include "BMPio.h"
+
+std::shared_ptr<const Image> AuxiliaryImages::Get(const char* path) {
+    std::error_code error;
+    std::string canonical = std::filesystem::weakly_canonical(path, error).string();
+    if (error) {
+        canonical = path;
+    }
+    if (auto it = by_path_.find(canonical); it != by_path_.end()) {
+        return entries_[it->second].image;
+    }
+    // hard links and bind mounts give the same file different paths
+    struct stat info {};
+    bool exists = stat(canonical.c_str(), &info) == 0;
+    FileId id(info.st_dev, info.st_ino, info.st_mtim.tv_sec, info.st_mtim.tv_nsec, info.st_size);
+    if (exists) {
+        if (auto it = by_file_.find(id); it != by_file_.end()) {
+            by_path_[canonical] = it->second;
+            return entries_[it->second].image;
+        }
+        by_file_[id] = entries_.size();
+    }
+    by_path_[canonical] = entries_.size();
+    entries_.push_back(Entry{path, std::make_shared<Image>(), {}});
+    return entries_.back().image;
+}
+
+void AuxiliaryImages::Load() {
+    for (auto& entry : entries_) {
+        if (!entry.loading.valid()) {
+            entry.loading = std::async(std::launch::async,
+                                       [path = entry.path, image = entry.image]() { ReadBMP(path.c_str(), *image); });
+        }
+    }
+}
+
+void AuxiliaryImages::Wait() {
+    Load();
+    std::exception_ptr error;
+    for (auto& entry : entries_) {
+        try {
+            entry.loading.get();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    entries_.clear();
+    by_path_.clear();
+    by_file_.clear();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
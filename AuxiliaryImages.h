@@ -0,0 +1,37 @@
+#pragma once
+
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "Image.h"
+
+// Images given to options such as -burn. They are collected while the options are parsed and then read
+// concurrently, with every file read once however many options or paths name it.
+class AuxiliaryImages {
+private:
+    struct Entry {
+        std::string path;
+        std::shared_ptr<Image> image;
+        std::future<void> loading;
+    };
+    // device, inode, modification time and size
+    using FileId = std::tuple<uint64_t, uint64_t, int64_t, int64_t, int64_t>;
+
+    std::vector<Entry> entries_;
+    std::map<std::string, size_t> by_path_;
+    std::map<FileId, size_t> by_file_;
+
+public:
+    // the image stays empty until Wait() returns
+    std::shared_ptr<const Image> Get(const char* path);
+
+    // starts reading the images that are not being read yet
+    void Load();
+
+    // waits for all images to be read, rethrowing the first error
+    void Wait();
+};
@@ -1,16 +1,40 @@
 #include "BMPio.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <bit>
+#include <sstream>
+#include <streambuf>
 
 #include "ImageException.h"
+#include "Parallel.h"
+#include "Tuning.h"
 
 const uint16_t BITS_PER_PIXEL = 24;
+const uint16_t BITS_PER_PIXEL_ALPHA = 32;
 const uint32_t OFFSET = 54;
 const uint32_t BMP_HEADER_SIZE = 14;
 const uint32_t DIB_HEADER_SIZE = 40;
+const uint32_t V2_HEADER_SIZE = 52;
+const uint32_t V3_HEADER_SIZE = 56;
+const uint32_t V4_HEADER_SIZE = 108;
+const uint32_t V5_HEADER_SIZE = 124;
+const uint32_t BI_RGB = 0;
+const uint32_t BI_BITFIELDS = 3;
+const uint32_t BI_ALPHABITFIELDS = 6;
+const uint32_t LCS_SRGB = 0x73524742;
+const size_t IO_BLOCK_SIZE = 1 << 20;
+const uint32_t PALETTE_ENTRY_SIZE = 4;
+
+size_t GetIOBlockSize() {
+    size_t tuned = Tuning::Get().io_block_size;
+    return tuned != 0 ? tuned : IO_BLOCK_SIZE;
+}
 
 template <typename INT>
-INT ReadVar(std::ifstream& in) {
+INT ReadVar(std::istream& in) {
     union {
         INT i;
         char c[sizeof(INT)];
@@ -22,15 +46,8 @@ INT ReadVar(std::ifstream& in) {
     return var.i;
 }
 
-template <>
-Image::Pixel ReadVar<Image::Pixel>(std::ifstream& in) {
-    unsigned char bgr[3];
-    in.read(reinterpret_cast<char*>(bgr), 3);
-    return Image::Pixel(bgr[2], bgr[1], bgr[0]);
-}
-
 template <typename INT>
-void WriteVar(std::ofstream& out, const INT& n) {
+void WriteVar(std::ostream& out, const INT& n) {
     union {
         INT i;
         char c[sizeof(INT)];
@@ -42,165 +59,549 @@ void WriteVar(std::ofstream& out, const INT& n) {
     out.write(var.c, sizeof(INT));
 }
 
-template <>
-void WriteVar<Image::Pixel>(std::ofstream& out, const Image::Pixel& pixel) {
-    unsigned char bgr[3];
-    bgr[0] = static_cast<unsigned char>(pixel.blue * Image::Pixel::DEPTH);
-    bgr[1] = static_cast<unsigned char>(pixel.green * Image::Pixel::DEPTH);
-    bgr[2] = static_cast<unsigned char>(pixel.red * Image::Pixel::DEPTH);
-    out.write(reinterpret_cast<char*>(bgr), 3);
+// reads the headers of files held in memory with the same code as the ones of files on disk
+class MemoryBuffer : public std::streambuf {
+public:
+    MemoryBuffer(const unsigned char* data, size_t size) {
+        // the buffer is only read from
+        char* begin = const_cast<char*>(reinterpret_cast<const char*>(data));
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    pos_type seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        char* base = (dir == std::ios_base::beg) ? eback() : (dir == std::ios_base::cur) ? gptr() : egptr();
+        if (offset < eback() - base || offset > egptr() - base) {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), base + offset, egptr());
+        return pos_type(gptr() - eback());
+    }
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode which) override {
+        return seekoff(off_type(position), std::ios_base::beg, which);
+    }
+};
+
+class FileDescriptor {
+public:
+    int fd;
+    explicit FileDescriptor(int descriptor) : fd(descriptor){};
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+    ~FileDescriptor() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+};
+
+void ReadAt(int fd, unsigned char* data, size_t size, size_t offset) {
+    while (size > 0) {
+        ssize_t read = pread(fd, data, size, static_cast<off_t>(offset));
+        if (read <= 0) {
+            throw ReadFileError();
+        }
+        data += read;
+        size -= read;
+        offset += read;
+    }
+}
+
+void WriteAt(int fd, const unsigned char* data, size_t size, size_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written <= 0) {
+            throw WriteFileError();
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
 }
 
 void ReadBMP::ReadBMPHeader() {
-    infile_.seekg(0);
+    in_->seekg(0);
     unsigned char bm[2];
-    infile_.read(reinterpret_cast<char*>(bm), 2);
+    in_->read(reinterpret_cast<char*>(bm), 2);
     if (bm[0] != 'B' || bm[1] != 'M') {
         throw WrongFileFormat();
     }
-    file_size_ = ReadVar<uint32_t>(infile_);
-    infile_.seekg(4, std::ios_base::cur);
-    offset_ = ReadVar<uint32_t>(infile_);
-    if (!infile_.good()) {
+    file_size_ = ReadVar<uint32_t>(*in_);
+    in_->seekg(4, std::ios_base::cur);
+    offset_ = ReadVar<uint32_t>(*in_);
+    if (!in_->good()) {
         throw ReadFileError();
     }
 }
 
 void ReadBMP::ReadDIBHeader() {
-    infile_.seekg(BMP_HEADER_SIZE);
-    uint32_t header_size = ReadVar<uint32_t>(infile_);
-    if (header_size != DIB_HEADER_SIZE) {
+    in_->seekg(BMP_HEADER_SIZE);
+    header_size_ = ReadVar<uint32_t>(*in_);
+    if (header_size_ != DIB_HEADER_SIZE && header_size_ != V2_HEADER_SIZE && header_size_ != V3_HEADER_SIZE &&
+        header_size_ != V4_HEADER_SIZE && header_size_ != V5_HEADER_SIZE) {
         throw WrongFileFormat();
     }
-    width_ = ReadVar<int32_t>(infile_);
-    height_ = -ReadVar<int32_t>(infile_);
+    width_ = ReadVar<int32_t>(*in_);
+    height_ = -ReadVar<int32_t>(*in_);
     if ((width_ == 0) != (height_ == 0)) {
         throw DamagedFile();
     }
-    uint16_t color_planes = ReadVar<uint16_t>(infile_);
+    uint16_t color_planes = ReadVar<uint16_t>(*in_);
     if (color_planes != 1) {
         throw WrongFileFormat();
     }
-    uint16_t bits_per_pixel = ReadVar<uint16_t>(infile_);
-    if (bits_per_pixel != BITS_PER_PIXEL) {
+    bits_per_pixel_ = ReadVar<uint16_t>(*in_);
+    if (bits_per_pixel_ != 1 && bits_per_pixel_ != 4 && bits_per_pixel_ != 8 && bits_per_pixel_ != BITS_PER_PIXEL &&
+        bits_per_pixel_ != BITS_PER_PIXEL_ALPHA) {
         throw WrongFileFormat();
     }
-    uint32_t compression = ReadVar<uint32_t>(infile_);
-    if (compression != 0) {
+    compression_ = ReadVar<uint32_t>(*in_);
+    bool bitfields = compression_ == BI_BITFIELDS || compression_ == BI_ALPHABITFIELDS;
+    if (compression_ != BI_RGB && (!bitfields || bits_per_pixel_ != BITS_PER_PIXEL_ALPHA)) {
         throw WrongFileFormat();
     }
-    uint32_t image_size = ReadVar<uint32_t>(infile_);
+    uint32_t image_size = ReadVar<uint32_t>(*in_);
     if (image_size != 0 &&
-        (image_size != static_cast<uint32_t>((3 * std::abs(width_) + 3) / 4 * 4) * std::abs(height_) ||
-         image_size + offset_ != file_size_)) {
+        (image_size != GetRowSize() * std::abs(height_) || image_size + offset_ != file_size_)) {
         throw DamagedFile();
     }
-    hor_res_ = ReadVar<int32_t>(infile_);
-    ver_res_ = ReadVar<int32_t>(infile_);
-    if (!infile_.good()) {
+    hor_res_ = ReadVar<int32_t>(*in_);
+    ver_res_ = ReadVar<int32_t>(*in_);
+    uint32_t colors_used = ReadVar<uint32_t>(*in_);
+    if (!in_->good()) {
         throw ReadFileError();
     }
+    if (bits_per_pixel_ == BITS_PER_PIXEL_ALPHA) {
+        ReadMasks();
+    } else if (bits_per_pixel_ <= 8) {
+        ReadPalette(colors_used);
+    }
+}
+
+void ReadBMP::ReadMasks() {
+    // BI_RGB stores BGRX pixels without alpha
+    masks_ = Image::ChannelMasks{};
+    masks_.alpha = 0;
+    if (compression_ == BI_RGB) {
+        return;
+    }
+    // the masks either end the V2-V5 headers or follow the 40-byte one
+    in_->seekg(BMP_HEADER_SIZE + DIB_HEADER_SIZE);
+    masks_.red = ReadVar<uint32_t>(*in_);
+    masks_.green = ReadVar<uint32_t>(*in_);
+    masks_.blue = ReadVar<uint32_t>(*in_);
+    if (header_size_ >= V3_HEADER_SIZE || compression_ == BI_ALPHABITFIELDS) {
+        masks_.alpha = ReadVar<uint32_t>(*in_);
+    }
+    if (!in_->good()) {
+        throw ReadFileError();
+    }
+    for (uint32_t mask : {masks_.red, masks_.green, masks_.blue, masks_.alpha}) {
+        uint32_t shifted = (mask != 0) ? mask >> std::countr_zero(mask) : 0;
+        if ((shifted & (shifted + 1)) != 0) {
+            throw WrongFileFormat();
+        }
+    }
+    if (masks_.red == 0 || masks_.green == 0 || masks_.blue == 0) {
+        throw WrongFileFormat();
+    }
+}
+
+void ReadBMP::ReadPalette(uint32_t colors_used) {
+    uint32_t colors = (colors_used != 0) ? colors_used : 1u << bits_per_pixel_;
+    if (colors > (1u << bits_per_pixel_)) {
+        throw DamagedFile();
+    }
+    in_->seekg(BMP_HEADER_SIZE + header_size_);
+    palette_.resize(colors);
+    gray_palette_ = true;
+    for (auto& color : palette_) {
+        unsigned char bgrx[PALETTE_ENTRY_SIZE];
+        in_->read(reinterpret_cast<char*>(bgrx), PALETTE_ENTRY_SIZE);
+        color = Image::Pixel(bgrx[2], bgrx[1], bgrx[0]);
+        gray_palette_ = gray_palette_ && bgrx[0] == bgrx[1] && bgrx[1] == bgrx[2];
+    }
+    if (!in_->good()) {
+        throw ReadFileError();
+    }
+}
+
+uint32_t ReadBMP::GetRowSize() const {
+    return (static_cast<uint32_t>(std::abs(width_)) * bits_per_pixel_ + 31) / 32 * 4;
+}
+
+long double ChannelValue(uint32_t value, uint32_t mask) {
+    if (mask == 0) {
+        return 0;
+    }
+    int shift = std::countr_zero(mask);
+    return static_cast<long double>((value & mask) >> shift) / static_cast<long double>(mask >> shift);
+}
+
+void ReadBMP::DecodeRow(const unsigned char* row, size_t x, Image& image) const {
+    size_t width = std::abs(width_);
+    for (size_t i = 0; i < width; ++i) {
+        size_t y = (width_ > 0) ? i : width - 1 - i;
+        Image::Pixel pixel;
+        if (bits_per_pixel_ == BITS_PER_PIXEL) {
+            pixel = Image::Pixel(row[3 * i + 2], row[3 * i + 1], row[3 * i]);
+        } else if (bits_per_pixel_ == BITS_PER_PIXEL_ALPHA) {
+            uint32_t value = row[4 * i] | (row[4 * i + 1] << 8) | (row[4 * i + 2] << 16) |
+                             (static_cast<uint32_t>(row[4 * i + 3]) << 24);
+            pixel = Image::Pixel(ChannelValue(value, masks_.red), ChannelValue(value, masks_.green),
+                                 ChannelValue(value, masks_.blue));
+            if (masks_.alpha != 0) {
+                image.AlphaAt(x, y) = ChannelValue(value, masks_.alpha);
+            }
+        } else {
+            size_t bit = i * bits_per_pixel_;
+            size_t index = (row[bit / 8] >> (8 - bits_per_pixel_ - bit % 8)) & ((1u << bits_per_pixel_) - 1);
+            if (index >= palette_.size()) {
+                throw DamagedFile();
+            }
+            pixel = palette_[index];
+        }
+        if (image.IsGray()) {
+            image.GrayAt(x, y) = pixel.red;
+        } else {
+            image.At(x, y) = pixel;
+        }
+    }
+}
+
+void ReadBMP::ReadHeaders(std::istream& in) {
+    in_ = &in;
+    ReadBMPHeader();
+    ReadDIBHeader();
+    in_ = nullptr;
+}
+
+Image ReadBMP::Allocate(size_t height) const {
+    size_t width = std::abs(width_);
+    Image result;
+    if (bits_per_pixel_ <= 8 && gray_palette_) {
+        result = Image(Image::GrayGrid(height, std::vector<long double>(width)), hor_res_, ver_res_);
+    } else {
+        result = Image(std::vector<std::vector<Image::Pixel>>(height, std::vector<Image::Pixel>(width)), hor_res_,
+                       ver_res_);
+    }
+    if (bits_per_pixel_ == BITS_PER_PIXEL_ALPHA) {
+        result.SetMasks(masks_);
+        if (masks_.alpha != 0) {
+            result.SetAlpha(Image::GrayGrid(height, std::vector<long double>(width)));
+        }
+    }
+    return result;
 }
 
 void ReadBMP::operator()(const char* filename, Image& image) {
-    infile_.open(filename, std::ios::binary | std::ios::in);
+    Open(filename);
+    image = ReadRows(0, GetHeight());
+}
 
-    if (!infile_.is_open()) {
+void ReadBMP::Open(const char* filename) {
+    std::ifstream infile(filename, std::ios::binary | std::ios::in);
+    if (!infile.is_open()) {
         throw OpenFileError(filename);
     }
     try {
-        ReadBMPHeader();
-        ReadDIBHeader();
+        ReadHeaders(infile);
     } catch (FileException& e) {
         e.SetFile(filename);
         throw e;
     }
-    std::vector<std::vector<Image::Pixel>> grid(std::abs(height_), std::vector<Image::Pixel>(std::abs(width_)));
-    infile_.seekg(offset_);
-    for (size_t i = std::abs(std::min(1, height_)); i > 0 && i <= std::abs(height_); i += (height_ > 0) ? 1 : -1) {
-        for (size_t j = std::abs(std::min(1, width_)); j > 0 && j <= std::abs(width_); j += (width_ > 0) ? 1 : -1) {
-            grid[i - 1][j - 1] = ReadVar<Image::Pixel>(infile_);
-        }
-        infile_.seekg((4 - (3 * std::abs(width_)) % 4) % 4, std::ios_base::cur);
+    filename_ = filename;
+}
+
+size_t ReadBMP::GetHeight() const {
+    return std::abs(height_);
+}
+
+size_t ReadBMP::GetWidth() const {
+    return std::abs(width_);
+}
+
+Image::Format ReadBMP::GetFormat() const {
+    return (bits_per_pixel_ <= 8 && gray_palette_) ? Image::Format::GRAY : Image::Format::RGB;
+}
+
+bool ReadBMP::HasAlpha() const {
+    return bits_per_pixel_ == BITS_PER_PIXEL_ALPHA && masks_.alpha != 0;
+}
+
+Image ReadBMP::ReadRows(size_t x, size_t height) const {
+    size_t frame_height = GetHeight();
+    if (x + height > frame_height) {
+        throw OutOfBounds(x + height - 1, 0, frame_height, GetWidth());
+    }
+    Image result = Allocate(height);
+    FileDescriptor file(open(filename_.c_str(), O_RDONLY));
+    if (file.fd < 0) {
+        throw OpenFileError(filename_.c_str());
     }
-    if (!infile_.good()) {
-        throw ReadFileError(filename);
+    // rows are stored in the order of the image unless the height is negative
+    size_t first_line = (height_ > 0) ? x : frame_height - x - height;
+    // rows lie at fixed offsets, so every thread reads and decodes its own blocks of them
+    size_t row_size = std::max<size_t>(GetRowSize(), 1);
+    size_t block_rows = std::max<size_t>(GetIOBlockSize() / row_size, 1);
+    try {
+        ParallelFor(0, height, block_rows, [&](size_t begin, size_t end) {
+            std::vector<unsigned char> block(std::min(block_rows, end - begin) * row_size);
+            for (size_t first = begin; first < end; first += block_rows) {
+                size_t rows = std::min(block_rows, end - first);
+                ReadAt(file.fd, block.data(), rows * row_size, offset_ + (first_line + first) * row_size);
+                for (size_t i = 0; i < rows; ++i) {
+                    size_t line = first + i;
+                    DecodeRow(block.data() + i * row_size, (height_ > 0) ? line : height - 1 - line, result);
+                }
+            }
+        });
+    } catch (FileException& e) {
+        e.SetFile(filename_.c_str());
+        throw e;
+    }
+    // a whole image is a frame of its own, which filters changing its size keep it
+    if (height != frame_height) {
+        result.SetFrame(x, 0, frame_height, GetWidth());
+    }
+    return result;
+}
+
+void ReadBMP::operator()(const unsigned char* data, size_t size, Image& image) {
+    MemoryBuffer buffer(data, size);
+    std::istream in(&buffer);
+    ReadHeaders(in);
+    size_t height = std::abs(height_);
+    size_t row_size = GetRowSize();
+    if (offset_ > size || (size - offset_) / std::max<size_t>(row_size, 1) < height) {
+        throw ReadFileError();
     }
-    image = Image(grid, hor_res_, ver_res_);
-    infile_.close();
+    Image result = Allocate(height);
+    // the rows are decoded where they lie
+    ParallelFor(0, height, std::max<size_t>(GetIOBlockSize() / std::max<size_t>(row_size, 1), 1),
+                [&](size_t begin, size_t end) {
+                    for (size_t line = begin; line < end; ++line) {
+                        DecodeRow(data + offset_ + line * row_size, (height_ > 0) ? line : height - 1 - line, result);
+                    }
+                });
+    image = std::move(result);
 }
 
 ReadBMP::ReadBMP(const char* filename, Image& image) {
     operator()(filename, image);
 }
 
-ReadBMP::~ReadBMP() {
-    if (infile_.is_open()) {
-        infile_.close();
+uint32_t WriteBMP::GetOffset() const {
+    if (bits_per_pixel_ == BITS_PER_PIXEL_ALPHA) {
+        return BMP_HEADER_SIZE + V4_HEADER_SIZE;
+    }
+    if (bits_per_pixel_ < BITS_PER_PIXEL) {
+        return OFFSET + PALETTE_ENTRY_SIZE * (1u << bits_per_pixel_);
     }
+    return OFFSET;
+}
+
+uint32_t WriteBMP::GetRowSize(const Image& image) const {
+    return (image.GetWidth() * bits_per_pixel_ + 31) / 32 * 4;
 }
 
 void WriteBMP::WriteBMPHeader(const Image& image) {
-    outfile_.seekp(0);
-    outfile_.write("BM", 2);
-    uint32_t file_size = OFFSET + image.GetHeight() * ((image.GetWidth() * 3 + 3) / 4 * 4);
-    WriteVar(outfile_, file_size);
-    WriteVar<uint32_t>(outfile_, 0);  // reserved
-    WriteVar<uint32_t>(outfile_, OFFSET);
-    if (!outfile_.good()) {
+    out_->seekp(0);
+    out_->write("BM", 2);
+    uint32_t file_size = GetOffset() + height_ * GetRowSize(image);
+    WriteVar(*out_, file_size);
+    WriteVar<uint32_t>(*out_, 0);  // reserved
+    WriteVar<uint32_t>(*out_, GetOffset());
+    if (!out_->good()) {
         throw WriteFileError();
     }
 }
 
 void WriteBMP::WriteDIBHeader(const Image& image) {
-    outfile_.seekp(BMP_HEADER_SIZE);
-    WriteVar<uint32_t>(outfile_, DIB_HEADER_SIZE);
-    WriteVar(outfile_, static_cast<int32_t>(image.GetWidth()));
-    WriteVar(outfile_, static_cast<int32_t>(image.GetHeight()));
-    WriteVar<uint16_t>(outfile_, 1);  // color planes
-    WriteVar(outfile_, BITS_PER_PIXEL);
-    WriteVar<uint64_t>(outfile_, 0);  // compression method and image size
+    out_->seekp(BMP_HEADER_SIZE);
+    bool with_masks = bits_per_pixel_ == BITS_PER_PIXEL_ALPHA;
+    WriteVar<uint32_t>(*out_, with_masks ? V4_HEADER_SIZE : DIB_HEADER_SIZE);
+    WriteVar(*out_, static_cast<int32_t>(image.GetWidth()));
+    WriteVar(*out_, static_cast<int32_t>(height_));
+    WriteVar<uint16_t>(*out_, 1);  // color planes
+    WriteVar(*out_, bits_per_pixel_);
+    WriteVar<uint32_t>(*out_, with_masks ? BI_BITFIELDS : BI_RGB);
+    WriteVar<uint32_t>(*out_, 0);  // image size
     auto [hor, ver] = image.GetRes();
-    WriteVar(outfile_, hor);
-    WriteVar(outfile_, ver);
-    WriteVar<uint64_t>(outfile_, 0);
-    if (!outfile_.good()) {
+    WriteVar(*out_, hor);
+    WriteVar(*out_, ver);
+    WriteVar<uint32_t>(*out_, (bits_per_pixel_ < BITS_PER_PIXEL) ? 1u << bits_per_pixel_ : 0);  // palette size
+    WriteVar<uint32_t>(*out_, 0);  // important colors
+    if (with_masks) {
+        const Image::ChannelMasks& masks = image.GetMasks();
+        WriteVar(*out_, masks.red);
+        WriteVar(*out_, masks.green);
+        WriteVar(*out_, masks.blue);
+        WriteVar<uint32_t>(*out_, image.HasAlpha() ? masks.alpha : 0);
+        WriteVar(*out_, LCS_SRGB);
+        char unused[V4_HEADER_SIZE - DIB_HEADER_SIZE - 5 * sizeof(uint32_t)] = {};  // endpoints and gamma
+        out_->write(unused, sizeof(unused));
+    }
+    if (!out_->good()) {
         throw WriteFileError();
     }
 }
 
-void WriteBMP::operator()(const char* filename, const Image& image) {
-    outfile_.open(filename, std::ios::binary | std::ios::out | std::ios::trunc);
-    if (!outfile_.is_open()) {
+void WriteBMP::WritePalette() {
+    uint32_t colors = 1u << bits_per_pixel_;
+    for (uint32_t i = 0; i < colors; ++i) {
+        auto shade = static_cast<unsigned char>(i * 255 / (colors - 1));
+        unsigned char bgrx[PALETTE_ENTRY_SIZE] = {shade, shade, shade, 0};
+        out_->write(reinterpret_cast<char*>(bgrx), PALETTE_ENTRY_SIZE);
+    }
+    if (!out_->good()) {
+        throw WriteFileError();
+    }
+}
+
+uint32_t ChannelBits(long double value, uint32_t mask) {
+    if (mask == 0) {
+        return 0;
+    }
+    int shift = std::countr_zero(mask);
+    return (static_cast<uint32_t>(value * static_cast<long double>(mask >> shift)) << shift) & mask;
+}
+
+void WriteBMP::EncodeRow(const Image& image, size_t x, unsigned char* row) const {
+    std::fill(row, row + GetRowSize(image), 0);
+    if (bits_per_pixel_ == BITS_PER_PIXEL) {
+        for (size_t y = 0; y < image.GetWidth(); ++y) {
+            Image::Pixel pixel = image.Get(x, y);
+            row[3 * y] = static_cast<unsigned char>(pixel.blue * Image::Pixel::DEPTH);
+            row[3 * y + 1] = static_cast<unsigned char>(pixel.green * Image::Pixel::DEPTH);
+            row[3 * y + 2] = static_cast<unsigned char>(pixel.red * Image::Pixel::DEPTH);
+        }
+    } else if (bits_per_pixel_ == BITS_PER_PIXEL_ALPHA) {
+        const Image::ChannelMasks& masks = image.GetMasks();
+        for (size_t y = 0; y < image.GetWidth(); ++y) {
+            Image::Pixel pixel = image.Get(x, y);
+            uint32_t value = ChannelBits(pixel.red, masks.red) | ChannelBits(pixel.green, masks.green) |
+                             ChannelBits(pixel.blue, masks.blue);
+            if (image.HasAlpha()) {
+                value |= ChannelBits(image.AlphaAt(x, y), masks.alpha);
+            }
+            for (size_t k = 0; k < 4; ++k) {
+                row[4 * y + k] = static_cast<unsigned char>(value >> (8 * k));
+            }
+        }
+    } else {
+        for (size_t y = 0; y < image.GetWidth(); ++y) {
+            long double value = image.GrayAt(x, y);
+            if (bits_per_pixel_ == 8) {
+                row[y] = static_cast<unsigned char>(value * Image::Pixel::DEPTH);
+            } else if (value >= 0.5) {
+                row[y / 8] |= 0x80 >> (y % 8);
+            }
+        }
+    }
+}
+
+void WriteBMP::SetBitsPerPixel(const Image& image, uint16_t bits_per_pixel) {
+    if (bits_per_pixel != 1 && bits_per_pixel != 8 && bits_per_pixel != BITS_PER_PIXEL &&
+        bits_per_pixel != BITS_PER_PIXEL_ALPHA) {
+        throw WrongFileFormat();
+    }
+    if (bits_per_pixel < BITS_PER_PIXEL && !image.IsGray()) {
+        throw WrongPixelFormat();
+    }
+    bits_per_pixel_ = bits_per_pixel;
+}
+
+void WriteBMP::WriteHeaders(std::ostream& out, const Image& image) {
+    out_ = &out;
+    WriteBMPHeader(image);
+    WriteDIBHeader(image);
+    if (bits_per_pixel_ < BITS_PER_PIXEL) {
+        WritePalette();
+    }
+    out_ = nullptr;
+}
+
+void WriteBMP::operator()(const char* filename, const Image& image, uint16_t bits_per_pixel) {
+    Create(filename, image, image.GetHeight(), bits_per_pixel);
+    WriteRows(image, 0, 0, image.GetHeight());
+}
+
+void WriteBMP::Create(const char* filename, const Image& like, size_t height, uint16_t bits_per_pixel) {
+    try {
+        SetBitsPerPixel(like, bits_per_pixel);
+    } catch (FileException& e) {
+        e.SetFile(filename);
+        throw e;
+    }
+    height_ = height;
+    filename_ = filename;
+    std::ofstream outfile(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!outfile.is_open()) {
         throw OpenFileError(filename);
     }
     try {
-        WriteBMPHeader(image);
-        WriteDIBHeader(image);
+        WriteHeaders(outfile, like);
     } catch (FileException& e) {
         e.SetFile(filename);
         throw e;
     }
-    outfile_.seekp(OFFSET);
-    char align[4];
-    for (size_t i = image.GetHeight(); i > 0; --i) {
-        for (size_t j = 0; j < image.GetWidth(); ++j) {
-            WriteVar(outfile_, image.At(i - 1, j));
-        }
-        outfile_.write(align, static_cast<int32_t>((4 - (3 * image.GetWidth()) % 4) % 4));
+    outfile.close();
+    if (!outfile.good()) {
+        throw WriteFileError(filename);
     }
-    if (!outfile_.good()) {
+    FileDescriptor file(open(filename, O_WRONLY));
+    size_t row_size = std::max<size_t>(GetRowSize(like), 1);
+    if (file.fd < 0 || ftruncate(file.fd, static_cast<off_t>(GetOffset() + height * row_size)) != 0) {
         throw WriteFileError(filename);
     }
-    outfile_.close();
 }
 
-WriteBMP::WriteBMP(const char* filename, const Image& image) {
-    operator()(filename, image);
+void WriteBMP::WriteRows(const Image& image, size_t source_x, size_t x, size_t height) const {
+    FileDescriptor file(open(filename_.c_str(), O_WRONLY));
+    if (file.fd < 0) {
+        throw OpenFileError(filename_.c_str());
+    }
+    // rows are stored bottom-up at fixed offsets, so every thread encodes and writes its own blocks of them
+    size_t row_size = std::max<size_t>(GetRowSize(image), 1);
+    size_t block_rows = std::max<size_t>(GetIOBlockSize() / row_size, 1);
+    try {
+        ParallelFor(0, height, block_rows, [&](size_t begin, size_t end) {
+            std::vector<unsigned char> block(std::min(block_rows, end - begin) * row_size);
+            for (size_t first = begin; first < end; first += block_rows) {
+                size_t rows = std::min(block_rows, end - first);
+                for (size_t i = 0; i < rows; ++i) {
+                    EncodeRow(image, source_x + height - 1 - (first + i), block.data() + i * row_size);
+                }
+                size_t offset = GetOffset() + (height_ - x - height + first) * row_size;
+                WriteAt(file.fd, block.data(), rows * row_size, offset);
+            }
+        });
+    } catch (FileException& e) {
+        e.SetFile(filename_.c_str());
+        throw e;
+    }
 }
 
-WriteBMP::~WriteBMP() {
-    if (outfile_.is_open()) {
-        outfile_.close();
-    }
+void WriteBMP::operator()(const Image& image, std::vector<unsigned char>& data, uint16_t bits_per_pixel) {
+    SetBitsPerPixel(image, bits_per_pixel);
+    height_ = image.GetHeight();
+    std::ostringstream headers(std::ios::binary | std::ios::out);
+    WriteHeaders(headers, image);
+    std::string header_bytes = std::move(headers).str();
+    size_t row_size = GetRowSize(image);
+    data.resize(GetOffset() + image.GetHeight() * row_size);
+    std::copy(header_bytes.begin(), header_bytes.end(), data.begin());
+    // the rows are encoded in place
+    ParallelFor(0, image.GetHeight(), std::max<size_t>(GetIOBlockSize() / std::max<size_t>(row_size, 1), 1),
+                [&](size_t begin, size_t end) {
+                    for (size_t line = begin; line < end; ++line) {
+                        EncodeRow(image, image.GetHeight() - 1 - line, data.data() + GetOffset() + line * row_size);
+                    }
+                });
+}
+
+WriteBMP::WriteBMP(const char* filename, const Image& image, uint16_t bits_per_pixel) {
+    operator()(filename, image, bits_per_pixel);
 }
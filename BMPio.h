@@ -1,37 +1,93 @@
 #pragma once
 
 #include <fstream>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
 
 #include "Image.h"
 
+// bytes of rows the codec reads and decodes, or encodes and writes, per block; 1 MiB unless --tune picked another
+size_t GetIOBlockSize();
+
+// reads 1, 4 and 8-bit paletted, 24-bit and 32-bit (BI_RGB or with channel masks) files with any header from
+// BITMAPINFOHEADER to BITMAPV5HEADER; paletted files with a gray palette give GRAY images, 32-bit files with an
+// alpha mask give images with an alpha plane
 class ReadBMP {
 private:
-    std::ifstream infile_;
+    // the stream the headers are being read from
+    std::istream* in_ = nullptr;
+    // the file given to Open()
+    std::string filename_;
     uint32_t file_size_;
     uint32_t offset_;
+    uint32_t header_size_;
     int32_t width_;
     int32_t height_;
+    uint16_t bits_per_pixel_;
+    uint32_t compression_;
     int32_t hor_res_;
     int32_t ver_res_;
+    std::vector<Image::Pixel> palette_;
+    bool gray_palette_ = false;
+    Image::ChannelMasks masks_;
     void ReadBMPHeader();
     void ReadDIBHeader();
+    void ReadMasks();
+    void ReadPalette(uint32_t colors_used);
+    void ReadHeaders(std::istream& in);
+    uint32_t GetRowSize() const;
+    Image Allocate(size_t height) const;
+    void DecodeRow(const unsigned char* row, size_t x, Image& image) const;
 
 public:
     ReadBMP() = default;
     ReadBMP(const char* filename, Image& image);
     void operator()(const char* filename, Image& image);
-    ~ReadBMP();
+    // reads the headers of the file only, for the size and format of the image without decoding it
+    void Open(const char* filename);
+    size_t GetHeight() const;
+    size_t GetWidth() const;
+    Image::Format GetFormat() const;
+    bool HasAlpha() const;
+    // decodes rows [x, x + height) of the file given to Open(), with their alpha, as a window of the whole frame
+    Image ReadRows(size_t x, size_t height) const;
+    // decodes a whole file held in memory
+    void operator()(const unsigned char* data, size_t size, Image& image);
 };
 
+// 24 bits per pixel store the image as is, 32 bits per pixel add its alpha plane using its channel masks in a
+// BITMAPV4HEADER, 8 and 1 bits per pixel store a GRAY image with a grayscale palette (1 bit per pixel maps values
+// from 0.5 up to white and the rest to black)
 class WriteBMP {
 private:
-    std::ofstream outfile_;
+    // the stream the headers are being written to
+    std::ostream* out_ = nullptr;
+    uint16_t bits_per_pixel_ = 24;
+    // the height of the image in the file
+    size_t height_ = 0;
+    // the file given to Create()
+    std::string filename_;
+    uint32_t GetOffset() const;
+    uint32_t GetRowSize(const Image& image) const;
     void WriteBMPHeader(const Image& image);
     void WriteDIBHeader(const Image& image);
+    void WritePalette();
+    void SetBitsPerPixel(const Image& image, uint16_t bits_per_pixel);
+    void WriteHeaders(std::ostream& out, const Image& image);
+    void EncodeRow(const Image& image, size_t x, unsigned char* row) const;
 
 public:
     WriteBMP() = default;
-    WriteBMP(const char* filename, const Image& image);
-    void operator()(const char* filename, const Image& image);
-    ~WriteBMP();
+    WriteBMP(const char* filename, const Image& image, uint16_t bits_per_pixel = 24);
+    void operator()(const char* filename, const Image& image, uint16_t bits_per_pixel = 24);
+    // writes the headers of an image of the given height with the width, format, masks, alpha and resolution of like,
+    // and sizes the file for its rows, which WriteRows() then fills in any order
+    void Create(const char* filename, const Image& like, size_t height, uint16_t bits_per_pixel = 24);
+    // writes rows [source_x, source_x + height) of the image, as wide as like, as rows [x, x + height) of the file
+    // given to Create()
+    void WriteRows(const Image& image, size_t source_x, size_t x, size_t height) const;
+    // encodes the whole file into data
+    void operator()(const Image& image, std::vector<unsigned char>& data, uint16_t bits_per_pixel = 24);
 };
@@ -1,10 +1,20 @@
 #include "Filter.h"
 
+#include <algorithm>
 #include <cmath>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <utility>
 
 #include "ImageException.h"
+#include "ImageStatistics.h"
+#include "IntegralImage.h"
+#include "TaskGraph.h"
+#include "Transpose.h"
+#include "Tuning.h"
 
-void CropFilter::operator()(Image& image) {
+void CropFilter::operator()(Image& image) const {
     if (new_width_ == 0) {
         throw ProhibitedValue("0", "<width>");
     }
@@ -14,173 +24,1157 @@ void CropFilter::operator()(Image& image) {
     image.Resize(std::min(new_height_, image.GetHeight()), std::min(new_width_, image.GetWidth()));
 }
 
-void ByPixelFilter::operator()(Image& image) {
-    for (size_t i = 0; i < image.GetHeight(); ++i) {
-        for (size_t j = 0; j < image.GetWidth(); ++j) {
-            ComputePixel(image, i, j);
+namespace {
+const long double PI = std::acos(-1.0L);
+const long double LANCZOS_LOBES = 3;
+
+long double Lanczos(long double x) {
+    if (x == 0) {
+        return 1;
+    }
+    if (std::abs(x) >= LANCZOS_LOBES) {
+        return 0;
+    }
+    return LANCZOS_LOBES * std::sin(PI * x) * std::sin(PI * x / LANCZOS_LOBES) / (PI * PI * x * x);
+}
+
+// the source pixels every pixel of a resampled line is made of: weights for the pixels from first on
+struct Resampling {
+    std::vector<size_t> first;
+    std::vector<std::vector<long double>> weights;
+};
+
+Resampling MakeResampling(size_t length, size_t new_length) {
+    Resampling resampling;
+    resampling.first.resize(new_length);
+    resampling.weights.resize(new_length);
+    if (length % new_length == 0) {
+        size_t factor = length / new_length;
+        for (size_t i = 0; i < new_length; ++i) {
+            resampling.first[i] = i * factor;
+            resampling.weights[i].assign(factor, 1.0L / factor);
         }
+        return resampling;
     }
+    long double scale = static_cast<long double>(length) / new_length;
+    long double stretch = std::max<long double>(scale, 1);
+    long double support = LANCZOS_LOBES * stretch;
+    for (size_t i = 0; i < new_length; ++i) {
+        long double center = (i + 0.5L) * scale;
+        auto begin = static_cast<size_t>(std::max<long double>(0, std::floor(center - support)));
+        auto end = std::min(length, static_cast<size_t>(std::ceil(center + support)));
+        std::vector<long double>& weights = resampling.weights[i];
+        long double sum = 0;
+        for (size_t source = begin; source < end; ++source) {
+            weights.push_back(Lanczos((source + 0.5L - center) / stretch));
+            sum += weights.back();
+        }
+        for (long double& weight : weights) {
+            weight /= sum;
+        }
+        resampling.first[i] = begin;
+    }
+    return resampling;
 }
 
-void GrayscaleFilter::ComputePixel(Image& image, size_t x, size_t y) {
-    Image::Pixel& pixel = image.At(x, y);
-    long double gray_color = RED_MULT * pixel.red + GREEN_MULT * pixel.green + BLUE_MULT * pixel.blue;
-    pixel.red = gray_color;
-    pixel.green = gray_color;
-    pixel.blue = gray_color;
+void AddWeighted(long double& sum, long double value, long double weight) {
+    sum += value * weight;
 }
 
-void NegativeFilter::ComputePixel(Image& image, size_t x, size_t y) {
-    Image::Pixel& pixel = image.At(x, y);
-    pixel.red = 1 - pixel.red;
-    pixel.green = 1 - pixel.green;
-    pixel.blue = 1 - pixel.blue;
+void AddWeighted(Image::Pixel& sum, const Image::Pixel& value, long double weight) {
+    sum.red += value.red * weight;
+    sum.green += value.green * weight;
+    sum.blue += value.blue * weight;
 }
 
-void ThresholdFilter::ComputePixel(Image& image, size_t x, size_t y) {
-    Image::Pixel& pixel = image.At(x, y);
-    bool steps_over = (pixel.red > threshold_) && (pixel.green > threshold_) && (pixel.blue > threshold_);
-    pixel.red = steps_over;
-    pixel.green = steps_over;
-    pixel.blue = steps_over;
+// the negative lobes of the kernel overshoot at edges
+void ClampValue(long double& value) {
+    value = std::clamp<long double>(value, 0, 1);
+}
+
+void ClampValue(Image::Pixel& pixel) {
+    ClampValue(pixel.red);
+    ClampValue(pixel.green);
+    ClampValue(pixel.blue);
 }
 
-void GaussianFilter::ComputeLine(Image& image, size_t line, size_t y) {
-    if (y == 0) {
-        prevs_.resize(image.GetWidth());
-        if (sigma_ == 0) {
-            throw ProhibitedValue(std::to_string(sigma_), "<sigma>");
+// one level of a Gaussian pyramid: every second value weighted with its neighbours by [1 4 6 4 1] / 16
+Resampling MakeReduction(size_t length) {
+    const long double weights[] = {1, 4, 6, 4, 1};
+    Resampling resampling;
+    for (size_t i = 0; i < length; i += 2) {
+        size_t first = i - std::min<size_t>(i, 2);
+        size_t last = std::min(length, i + 3);
+        resampling.first.push_back(first);
+        std::vector<long double>& line = resampling.weights.emplace_back();
+        long double sum = 0;
+        for (size_t source = first; source < last; ++source) {
+            line.push_back(weights[source + 2 - i]);
+            sum += line.back();
         }
-        size_ = static_cast<ssize_t>(image.GetWidth());
-        if (4 * sigma_ < size_ + 1) {
-            size_ = static_cast<ssize_t>(std::ceil(3 * sigma_));
+        for (long double& weight : line) {
+            weight /= sum;
         }
-        gauss_.resize(2 * size_ + 1);
-        long double g_1 = std::pow(std::numbers::e_v<long double>, -1 / (2 * sigma_ * sigma_));
-        for (ssize_t i = -size_; i < size_ + 1; ++i) {
-            gauss_[i + size_] = std::pow(g_1, i * i);
+    }
+    return resampling;
+}
+
+// the inverse of MakeReduction(): values of a line of the given length interpolated from the samples of a halved one
+// by [1 4 6 4 1] / 8, which leaves a sample where it is and puts the values between two samples halfway
+Resampling MakeExpansion(size_t small_length, size_t length) {
+    const long double weights[] = {1, 4, 6, 4, 1};
+    Resampling resampling;
+    for (size_t i = 0; i < length; ++i) {
+        size_t first = (i - std::min<size_t>(i, 2) + 1) / 2;
+        size_t last = std::min(small_length, (i + 2) / 2 + 1);
+        resampling.first.push_back(first);
+        std::vector<long double>& line = resampling.weights.emplace_back();
+        long double sum = 0;
+        for (size_t source = first; source < last; ++source) {
+            line.push_back(weights[i + 2 - 2 * source]);
+            sum += line.back();
+        }
+        for (long double& weight : line) {
+            weight /= sum;
         }
     }
-    Image::Pixel pixel;
-    prevs_[y] = image.At(line, y);
-    long double sum = 0;
-    for (ssize_t j = static_cast<ssize_t>(y) - size_; j < static_cast<ssize_t>(y) + size_ + 1; ++j) {
-        if (j >= 0 && static_cast<size_t>(j) < image.GetWidth()) {
-            if (static_cast<size_t>(j) <= y) {
-                pixel += prevs_[j] * gauss_[j + size_ - y];
-            } else {
-                pixel += image.At(line, j) * gauss_[j + size_ - y];
+    return resampling;
+}
+
+// resamples the lines of a grid of rows given by row(x), then its columns, with contiguous loops over the rows
+template <typename V, typename F>
+std::vector<std::vector<V>> ResampleGrid(size_t height, F row, const Resampling& lines, const Resampling& columns,
+                                         size_t grain) {
+    size_t new_width = lines.first.size();
+    size_t new_height = columns.first.size();
+    std::vector<std::vector<V>> narrow(height, std::vector<V>(new_width));
+    ParallelFor(0, height, grain, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            std::span<const V> source = row(x);
+            for (size_t y = 0; y < new_width; ++y) {
+                V sum{};
+                const std::vector<long double>& weights = lines.weights[y];
+                for (size_t k = 0; k < weights.size(); ++k) {
+                    AddWeighted(sum, source[lines.first[y] + k], weights[k]);
+                }
+                narrow[x][y] = sum;
+            }
+        }
+    });
+    std::vector<std::vector<V>> result(new_height);
+    ParallelFor(0, new_height, grain, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            std::vector<V> target(new_width);
+            const std::vector<long double>& weights = columns.weights[x];
+            for (size_t k = 0; k < weights.size(); ++k) {
+                const std::vector<V>& source = narrow[columns.first[x] + k];
+                for (size_t y = 0; y < new_width; ++y) {
+                    AddWeighted(target[y], source[y], weights[k]);
+                }
+            }
+            for (V& value : target) {
+                ClampValue(value);
             }
-            sum += gauss_[j + size_ - y];
+            result[x] = std::move(target);
         }
+    });
+    return result;
+}
+}  // namespace
+
+template <typename V>
+std::vector<std::vector<V>> ResizeFilter::Resample(const Image& image, size_t new_height, size_t new_width) {
+    return ResampleGrid<V>(
+        image.GetHeight(), [&image](size_t x) { return image.Row<V>(x); },
+        MakeResampling(image.GetWidth(), new_width), MakeResampling(image.GetHeight(), new_height), ROWS_GRAIN);
+}
+
+std::pair<size_t, size_t> ResizeFilter::GetSize(size_t height, size_t width) const {
+    return {new_height_, new_width_};
+}
+
+void ResizeFilter::operator()(Image& image) const {
+    auto [new_height, new_width] = GetSize(image.GetHeight(), image.GetWidth());
+    if (new_width == 0) {
+        throw ProhibitedValue("0", "<width>");
     }
-    pixel = pixel / sum;
-    image.At(line, y) = pixel;
+    if (new_height == 0) {
+        throw ProhibitedValue("0", "<height>");
+    }
+    if (image.GetHeight() == 0 || image.GetWidth() == 0 ||
+        (new_height == image.GetHeight() && new_width == image.GetWidth())) {
+        return;
+    }
+    auto [hor_res, ver_res] = image.GetRes();
+    Image::GrayGrid alpha = image.ReleaseAlpha();
+    Image result;
+    if (image.IsGray()) {
+        result = Image(Resample<long double>(image, new_height, new_width), hor_res, ver_res);
+    } else {
+        result = Image(Resample<Image::Pixel>(image, new_height, new_width), hor_res, ver_res);
+    }
+    if (!alpha.empty()) {
+        result.SetAlpha(ResampleGrid<long double>(
+            alpha.size(), [&alpha](size_t x) { return std::span<const long double>(alpha[x]); },
+            MakeResampling(alpha[0].size(), new_width), MakeResampling(alpha.size(), new_height), ROWS_GRAIN));
+    }
+    result.SetMasks(image.GetMasks());
+    image = std::move(result);
 }
 
-void GaussianFilter::ComputeRow(Image& image, size_t x, size_t row) {
-    if (x == 0) {
-        prevs_.resize(image.GetHeight());
-        size_ = static_cast<ssize_t>(image.GetHeight());
-        if (4 * sigma_ < size_ + 1) {
-            size_ = static_cast<ssize_t>(std::ceil(3 * sigma_));
+std::pair<size_t, size_t> ThumbnailFilter::GetSize(size_t height, size_t width) const {
+    if (height <= size_ && width <= size_) {
+        return {height, width};
+    }
+    if (width >= height) {
+        return {std::max<size_t>(1, (height * size_ + width / 2) / width), size_};
+    }
+    return {size_, std::max<size_t>(1, (width * size_ + height / 2) / height)};
+}
+
+size_t ResizeFilter::GetWorkspace(size_t height, size_t width, Image::Format format) const {
+    auto [new_height, new_width] = GetSize(height, width);
+    return Image::GetBytes(std::max(height * new_width, new_height * width) + new_height * new_width, 1, format);
+}
+
+long double ResizeFilter::GetCost(size_t height, size_t width, Image::Format format) const {
+    auto [new_height, new_width] = GetSize(height, width);
+    // a block average takes factor taps, the Lanczos kernel 3 lobes on each side, widened by the factor when shrinking
+    auto taps = [](size_t length, size_t new_length) -> long double {
+        if (new_length == 0 || length == 0) {
+            return 0;
         }
-        gauss_.resize(2 * size_ + 1);
-        long double g_1 = std::pow(std::numbers::e_v<long double>, -1 / (2 * sigma_ * sigma_));
-        for (ssize_t i = -size_; i < size_ + 1; ++i) {
-            gauss_[i + size_] = std::pow(g_1, i * i);
+        if (length >= new_length && length % new_length == 0) {
+            return static_cast<long double>(length / new_length);
         }
+        return 6 * std::max<long double>(static_cast<long double>(length) / new_length, 1);
+    };
+    long double cost = PerPixel(height, new_width, format, 20, 5) * taps(width, new_width) +
+                       PerPixel(new_height, new_width, format, 20, 5) * taps(height, new_height) +
+                       PerPixel(height, width, format, 40, 10) + PerPixel(new_height, new_width, format, 40, 10);
+    return cost / GetThreadCount();
+}
+
+void ThumbnailFilter::operator()(Image& image) const {
+    if (size_ == 0) {
+        throw ProhibitedValue("0", "<size>");
     }
-    Image::Pixel pixel;
-    prevs_[x] = image.At(x, row);
-    long double sum = 0;
-    for (ssize_t i = static_cast<ssize_t>(x) - size_; i < static_cast<ssize_t>(x) + size_ + 1; ++i) {
-        if (i >= 0 && static_cast<size_t>(i) < image.GetHeight()) {
-            if (static_cast<size_t>(i) <= x) {
-                pixel += prevs_[i] * gauss_[i + size_ - x];
+    ResizeFilter::operator()(image);
+}
+
+namespace {
+// the transpose of a grid of rows given by row(x), reading those rows from the last one if from_last_row and writing
+// the rows of the transpose from the last one if to_last_row; bands of rows of the transpose are written in parallel
+template <typename V, typename F>
+std::vector<std::vector<V>> TransposeGrid(size_t height, F row, bool from_last_row, bool to_last_row, size_t grain) {
+    std::vector<std::span<const V>> rows(height);
+    for (size_t x = 0; x < height; ++x) {
+        rows[from_last_row ? height - 1 - x : x] = row(x);
+    }
+    size_t width = rows[0].size();
+    std::vector<std::vector<V>> result(width, std::vector<V>(height));
+    ParallelFor(0, width, grain, [&](size_t begin, size_t end) {
+        TransposeBlocks(0, height, begin, end, [&](size_t x, size_t y) {
+            result[to_last_row ? width - 1 - y : y][x] = rows[x][y];
+        });
+    });
+    return result;
+}
+}  // namespace
+
+std::pair<size_t, size_t> RotateFilter::GetSize(size_t height, size_t width) const {
+    if (degrees_ == 180) {
+        return {height, width};
+    }
+    return {width, height};
+}
+
+void RotateFilter::operator()(Image& image) const {
+    if (degrees_ != 90 && degrees_ != 180 && degrees_ != 270) {
+        throw ProhibitedValue(std::to_string(degrees_), "<degrees>");
+    }
+    if (image.GetHeight() == 0 || image.GetWidth() == 0) {
+        return;
+    }
+    if (degrees_ == 180) {
+        FlipVerticalFilter{}(image);
+        FlipHorizontalFilter{}(image);
+        return;
+    }
+    // turning clockwise, the first row of the result is the first column read from the bottom
+    bool clockwise = degrees_ == 90;
+    auto [hor_res, ver_res] = image.GetRes();
+    Image::GrayGrid alpha = image.ReleaseAlpha();
+    Image result;
+    if (image.IsGray()) {
+        result = Image(TransposeGrid<long double>(
+                           image.GetHeight(), [&image](size_t x) { return std::as_const(image).GrayRow(x); },
+                           clockwise, !clockwise, ROWS_GRAIN),
+                       ver_res, hor_res);
+    } else {
+        result = Image(TransposeGrid<Image::Pixel>(
+                           image.GetHeight(), [&image](size_t x) { return std::as_const(image).PixelRow(x); },
+                           clockwise, !clockwise, ROWS_GRAIN),
+                       ver_res, hor_res);
+    }
+    if (!alpha.empty()) {
+        result.SetAlpha(TransposeGrid<long double>(
+            alpha.size(), [&alpha](size_t x) { return std::span<const long double>(alpha[x]); }, clockwise,
+            !clockwise, ROWS_GRAIN));
+    }
+    result.SetMasks(image.GetMasks());
+    image = std::move(result);
+}
+
+void FlipVerticalFilter::operator()(Image& image) const {
+    image.FlipRows();
+}
+
+void FlipHorizontalFilter::operator()(Image& image) const {
+    Image::GrayGrid alpha = image.ReleaseAlpha();
+    bool gray = image.IsGray();
+    ParallelFor(0, image.GetHeight(), ROWS_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            if (gray) {
+                std::span<long double> row = image.GrayRow(x);
+                std::reverse(row.begin(), row.end());
             } else {
-                pixel += image.At(i, row) * gauss_[i + size_ - x];
+                std::span<Image::Pixel> row = image.PixelRow(x);
+                std::reverse(row.begin(), row.end());
+            }
+            if (!alpha.empty()) {
+                std::reverse(alpha[x].begin(), alpha[x].end());
             }
-            sum += gauss_[i + size_ - x];
         }
-    }
-    pixel = pixel / sum;
-    image.At(x, row) = pixel;
+    });
+    image.SetAlpha(std::move(alpha));
 }
 
-void GaussianFilter::operator()(Image& image) {
+void ByPixelFilter::operator()(Image& image) const {
+    if (image.IsGray() && SupportsGray()) {
+        for (size_t i = 0; i < image.GetHeight(); ++i) {
+            for (size_t j = 0; j < image.GetWidth(); ++j) {
+                ComputeGrayPixel(image, i, j);
+            }
+        }
+        return;
+    }
+    image.ToRGB();
     for (size_t i = 0; i < image.GetHeight(); ++i) {
         for (size_t j = 0; j < image.GetWidth(); ++j) {
-            ComputeLine(image, i, j);
+            ComputePixel(image, i, j);
         }
     }
-    for (size_t j = 0; j < image.GetWidth(); ++j) {
+}
+
+void PointFilter::ComputePixel(Image& image, size_t x, size_t y) const {
+    Image::Pixel& pixel = image.At(x, y);
+    pixel.red = Map(pixel.red);
+    pixel.green = Map(pixel.green);
+    pixel.blue = Map(pixel.blue);
+}
+
+void PointFilter::ComputeGrayPixel(Image& image, size_t x, size_t y) const {
+    long double& value = image.GrayAt(x, y);
+    value = Map(value);
+}
+
+void PointFilter::operator()(Image& image) const {
+    if (!image.IsGray() && ReducesToGray()) {
+        image.ToGray([this](const Image::Pixel& pixel) { return Reduce(pixel); });
+        return;
+    }
+    ByPixelFilter::operator()(image);
+}
+
+size_t LutFilter::FindReduce() const {
+    size_t reduce = 0;
+    while (reduce < stages_.size() && !stages_[reduce]->ReducesToGray()) {
+        ++reduce;
+    }
+    return reduce;
+}
+
+LookupTable LutFilter::Compile(size_t begin, size_t end) const {
+    // the stages are owned through pointers, so the tables stay valid if the filter is moved
+    std::vector<const PointFilter*> stages;
+    for (size_t i = begin; i < end; ++i) {
+        stages.push_back(stages_[i].get());
+    }
+    return LookupTable([stages](long double value) {
+        for (const PointFilter* stage : stages) {
+            value = stage->Map(value);
+        }
+        return value;
+    });
+}
+
+std::string LutFilter::GetKey() const {
+    std::string key = NAME + "(";
+    for (size_t i = 0; i < stages_.size(); ++i) {
+        key += (i == 0 ? "" : ", ") + stages_[i]->GetKey();
+    }
+    return key + ")";
+}
+
+void LutFilter::operator()(Image& image) const {
+    if (image.IsGray()) {
         for (size_t i = 0; i < image.GetHeight(); ++i) {
-            ComputeRow(image, i, j);
+            for (size_t j = 0; j < image.GetWidth(); ++j) {
+                long double& value = image.GrayAt(i, j);
+                value = gray_(value);
+            }
         }
+        return;
     }
+    if (reduce_ == stages_.size()) {
+        for (size_t i = 0; i < image.GetHeight(); ++i) {
+            for (size_t j = 0; j < image.GetWidth(); ++j) {
+                Image::Pixel& pixel = image.At(i, j);
+                pixel = Image::Pixel(channel_(pixel.red), channel_(pixel.green), channel_(pixel.blue));
+            }
+        }
+        return;
+    }
+    const PointFilter& reduction = *stages_[reduce_];
+    image.ToGray([&](const Image::Pixel& pixel) {
+        return luma_(reduction.Reduce(Image::Pixel(channel_(pixel.red), channel_(pixel.green), channel_(pixel.blue))));
+    });
 }
 
-void Dodge(long double& bg, long double& fg) {
-    if (fg >= 1) {
-        bg = 1;
-    } else {
-        if (bg / (1 - fg) > 1) {
-            bg = 1;
+namespace {
+// [begin, end) of the positions of a line of the given length at most radius away from position
+std::pair<size_t, size_t> ClipWindow(size_t position, size_t radius, size_t length) {
+    return {position - std::min(position, radius), std::min(length, position + std::min(radius, length) + 1)};
+}
+}  // namespace
+
+void OtsuThresholdFilter::operator()(Image& image) const {
+    GrayscaleFilter{}(image);
+    ThresholdFilter(ImageStatistics(image).GetOtsuThreshold(ImageStatistics::Channel::LUMA))(image);
+}
+
+size_t AdaptiveThresholdFilter::GetWorkspace(size_t height, size_t width, Image::Format format) const {
+    return IntegralImage::GetBytes(height, width, format) + Image::GetBytes(height, width, Image::Format::GRAY);
+}
+
+void AdaptiveThresholdFilter::operator()(Image& image) const {
+    size_t height = image.GetHeight();
+    size_t width = image.GetWidth();
+    IntegralImage integral(image);
+    Image::GrayGrid result(height, std::vector<long double>(width));
+    ParallelFor(0, height, ROWS_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            auto [top, bottom] = ClipWindow(x, radius_, height);
+            for (size_t y = 0; y < width; ++y) {
+                auto [left, right] = ClipWindow(y, radius_, width);
+                // a flat neighbourhood has exactly the mean of its values
+                auto above = [&](size_t channel, long double value) {
+                    return IntegralImage::Round(value) > integral.Mean(channel, top, bottom, left, right) - offset_;
+                };
+                if (image.IsGray()) {
+                    result[x][y] = above(0, image.GrayAt(x, y));
+                } else {
+                    const Image::Pixel& pixel = std::as_const(image).At(x, y);
+                    result[x][y] = above(0, pixel.red) && above(1, pixel.green) && above(2, pixel.blue);
+                }
+            }
+        }
+    });
+    image.SetGray(std::move(result));
+}
+
+void EdgeDetectionFilter::operator()(Image& image) const {
+    size_t height = image.GetHeight();
+    size_t width = image.GetWidth();
+    auto luma_line = [&image, width](size_t x, std::vector<long double>& line) {
+        for (size_t y = 0; y < width; ++y) {
+            line[y] = image.IsGray() ? GrayscaleFilter::Luma(image.GrayAt(x, y))
+                                     : GrayscaleFilter::Luma(image.At(x, y));
+        }
+    };
+    std::vector<long double> prev_line(width);
+    std::vector<long double> cur_line(width);
+    std::vector<long double> next_line(width);
+    Image::GrayGrid result(height, std::vector<long double>(width));
+    if (height > 0) {
+        luma_line(0, cur_line);
+    }
+    prev_line = cur_line;
+    for (size_t x = 0; x < height; ++x) {
+        if (x + 1 < height) {
+            luma_line(x + 1, next_line);
         } else {
-            bg = bg / (1 - fg);
+            next_line = cur_line;
+        }
+        for (size_t y = 0; y < width; ++y) {
+            size_t left = (y > 0) ? y - 1 : 0;
+            size_t right = (y + 1 < width) ? y + 1 : y;
+            // same summation order as the 3x3 matrix convolution
+            long double value = -prev_line[y] - cur_line[left] + 4 * cur_line[y] - cur_line[right] - next_line[y];
+            value = std::clamp<long double>(value, 0, 1);
+            result[x][y] = automatic_ ? value : value > threshold_;
         }
+        std::swap(prev_line, cur_line);
+        std::swap(cur_line, next_line);
+    }
+    image.SetGray(std::move(result));
+    if (automatic_) {
+        ThresholdFilter(ImageStatistics(image).GetOtsuThreshold(ImageStatistics::Channel::LUMA))(image);
     }
 }
 
-void ColorDodgeFilter::ComputePixel(Image& image, size_t x, size_t y) {
-    if (x >= second_->GetHeight() || y >= second_->GetWidth()) {
-        return;
+size_t BoxFilter::GetWorkspace(size_t height, size_t width, Image::Format format) const {
+    return IntegralImage::GetBytes(height, width, format);
+}
+
+void BoxFilter::operator()(Image& image) const {
+    size_t height = image.GetHeight();
+    size_t width = image.GetWidth();
+    IntegralImage integral(image);
+    ParallelFor(0, height, ROWS_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            auto [top, bottom] = ClipWindow(x, radius_, height);
+            for (size_t y = 0; y < width; ++y) {
+                auto [left, right] = ClipWindow(y, radius_, width);
+                auto mean = [&](size_t channel) { return integral.Mean(channel, top, bottom, left, right); };
+                if (image.IsGray()) {
+                    image.GrayAt(x, y) = mean(0);
+                } else {
+                    image.At(x, y) = Image::Pixel(mean(0), mean(1), mean(2));
+                }
+            }
+        }
+    });
+}
+
+namespace {
+const size_t LEVELS = 256;
+// levels of a coarse bin of the histograms of the median
+const size_t COARSE_LEVELS = 16;
+
+// the compare-exchanges of the median of 9 values, after Paeth: the median ends up at 4
+const std::array<std::pair<size_t, size_t>, 19> MEDIAN_NETWORK = {{{1, 2}, {4, 5}, {7, 8}, {0, 1}, {3, 4},
+                                                                   {6, 7}, {1, 2}, {4, 5}, {7, 8}, {0, 3},
+                                                                   {5, 8}, {4, 7}, {3, 6}, {1, 4}, {2, 5},
+                                                                   {4, 7}, {4, 2}, {6, 4}, {4, 2}}};
+
+uint8_t ToLevel(long double value) {
+    return static_cast<uint8_t>(std::clamp<long double>(std::round(value * Image::Pixel::DEPTH), 0, LEVELS - 1));
+}
+
+// the levels of the channels of the image, a plane of height x width levels per channel
+std::vector<uint8_t> ToLevelPlanes(const Image& image, size_t grain) {
+    size_t height = image.GetHeight();
+    size_t width = image.GetWidth();
+    size_t channels = image.IsGray() ? 1 : 3;
+    std::vector<uint8_t> planes(channels * height * width);
+    ParallelFor(0, height, grain, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            for (size_t y = 0; y < width; ++y) {
+                if (channels == 1) {
+                    planes[x * width + y] = ToLevel(image.GrayAt(x, y));
+                } else {
+                    const Image::Pixel& pixel = image.At(x, y);
+                    planes[x * width + y] = ToLevel(pixel.red);
+                    planes[(height + x) * width + y] = ToLevel(pixel.green);
+                    planes[(2 * height + x) * width + y] = ToLevel(pixel.blue);
+                }
+            }
+        }
+    });
+    return planes;
+}
+
+// medians of the 3x3 squares of the pixels of rows [begin, end) of a plane
+void MedianByNetwork(const uint8_t* plane, uint8_t* result, size_t height, size_t width, size_t begin, size_t end) {
+    for (size_t x = begin; x < end; ++x) {
+        const uint8_t* rows[] = {plane + (x > 0 ? x - 1 : 0) * width, plane + x * width,
+                                 plane + std::min(x + 1, height - 1) * width};
+        for (size_t y = 0; y < width; ++y) {
+            size_t columns[] = {y > 0 ? y - 1 : 0, y, std::min(y + 1, width - 1)};
+            std::array<uint8_t, 9> values;
+            for (size_t i = 0; i < 3; ++i) {
+                for (size_t j = 0; j < 3; ++j) {
+                    values[3 * i + j] = rows[i][columns[j]];
+                }
+            }
+            for (auto [first, second] : MEDIAN_NETWORK) {
+                uint8_t low = std::min(values[first], values[second]);
+                values[second] = std::max(values[first], values[second]);
+                values[first] = low;
+            }
+            result[x * width + y] = values[4];
+        }
+    }
+}
+
+// medians of the squares of side 2 * radius + 1 of the pixels of columns [begin, end) of a plane. Every column the
+// squares reach has a histogram of its pixels in the rows of the square, moved down a row by taking one pixel out and
+// one in; the histogram of a square is moved right along a row by taking the histogram of one column out and one in.
+// Histograms have a coarse level of 16 bins to find the bin of the median in before the 16 levels within it
+void MedianByHistograms(const uint8_t* plane, uint8_t* result, size_t height, size_t width, size_t radius,
+                        size_t begin, size_t end) {
+    size_t first = begin - std::min(begin, radius);
+    size_t last = std::min(width, end + radius);
+    size_t coarse_bins = LEVELS / COARSE_LEVELS;
+    std::vector<uint32_t> fine((last - first) * LEVELS);
+    std::vector<uint32_t> coarse((last - first) * coarse_bins);
+    auto count = [&](size_t column, uint8_t level, uint32_t times, bool add) {
+        uint32_t& fine_count = fine[(column - first) * LEVELS + level];
+        uint32_t& coarse_count = coarse[(column - first) * coarse_bins + level / COARSE_LEVELS];
+        fine_count = add ? fine_count + times : fine_count - times;
+        coarse_count = add ? coarse_count + times : coarse_count - times;
     };
-    Image::Pixel base = image.At(x, y);
-    Image::Pixel added = second_->At(x, y);
-    Dodge(base.red, added.red);
-    Dodge(base.green, added.green);
-    Dodge(base.blue, added.blue);
-    image.At(x, y) = base;
+    for (size_t j = first; j < last; ++j) {
+        // the rows above the image repeat the first one
+        count(j, plane[j], radius + 1, true);
+        for (size_t i = 1; i <= radius; ++i) {
+            count(j, plane[std::min(i, height - 1) * width + j], 1, true);
+        }
+    }
+    std::array<uint32_t, LEVELS> square_fine;
+    std::vector<uint32_t> square_coarse(coarse_bins);
+    auto merge = [&](size_t column, bool add) {
+        column = std::min(column, width - 1);
+        const uint32_t* column_fine = fine.data() + (column - first) * LEVELS;
+        const uint32_t* column_coarse = coarse.data() + (column - first) * coarse_bins;
+        if (add) {
+            for (size_t k = 0; k < LEVELS; ++k) {
+                square_fine[k] += column_fine[k];
+            }
+            for (size_t k = 0; k < coarse_bins; ++k) {
+                square_coarse[k] += column_coarse[k];
+            }
+        } else {
+            for (size_t k = 0; k < LEVELS; ++k) {
+                square_fine[k] -= column_fine[k];
+            }
+            for (size_t k = 0; k < coarse_bins; ++k) {
+                square_coarse[k] -= column_coarse[k];
+            }
+        }
+    };
+    uint32_t rank = static_cast<uint32_t>((2 * radius + 1) * (2 * radius + 1) / 2);
+    for (size_t x = 0; x < height; ++x) {
+        if (x > 0) {
+            size_t gone = (x > radius) ? x - radius - 1 : 0;
+            size_t added = std::min(x + radius, height - 1);
+            for (size_t j = first; j < last; ++j) {
+                count(j, plane[gone * width + j], 1, false);
+                count(j, plane[added * width + j], 1, true);
+            }
+        }
+        square_fine.fill(0);
+        std::fill(square_coarse.begin(), square_coarse.end(), 0);
+        // the columns left of the image repeat the first one
+        for (size_t k = 0; k <= 2 * radius; ++k) {
+            merge(begin + k > radius ? begin + k - radius : 0, true);
+        }
+        for (size_t y = begin; y < end; ++y) {
+            if (y > begin) {
+                merge(y > radius + 1 ? y - radius - 1 : 0, false);
+                merge(y + radius, true);
+            }
+            uint32_t seen = 0;
+            size_t bin = 0;
+            while (seen + square_coarse[bin] <= rank) {
+                seen += square_coarse[bin];
+                ++bin;
+            }
+            size_t level = bin * COARSE_LEVELS;
+            while (seen + square_fine[level] <= rank) {
+                seen += square_fine[level];
+                ++level;
+            }
+            result[x * width + y] = static_cast<uint8_t>(level);
+        }
+    }
 }
+}  // namespace
 
-void Burn(long double& bg, long double& fg) {
-    if (fg <= 0) {
-        bg = 0;
-    } else {
-        if ((1 - bg) / fg > 1) {
-            bg = 0;
+void MedianFilter::operator()(Image& image) const {
+    size_t height = image.GetHeight();
+    size_t width = image.GetWidth();
+    if (radius_ == 0 || height == 0 || width == 0) {
+        return;
+    }
+    size_t channels = image.IsGray() ? 1 : 3;
+    std::vector<uint8_t> planes = ToLevelPlanes(image, ROWS_GRAIN);
+    std::vector<uint8_t> medians(planes.size());
+    for (size_t c = 0; c < channels; ++c) {
+        const uint8_t* plane = planes.data() + c * height * width;
+        uint8_t* result = medians.data() + c * height * width;
+        if (radius_ == 1) {
+            ParallelFor(0, height, ROWS_GRAIN, [&](size_t begin, size_t end) {
+                MedianByNetwork(plane, result, height, width, begin, end);
+            });
         } else {
-            bg = 1 - (1 - bg) / fg;
+            ParallelFor(0, width, COLUMNS_GRAIN, [&](size_t begin, size_t end) {
+                MedianByHistograms(plane, result, height, width, radius_, begin, end);
+            });
+        }
+    }
+    const auto& grid = LookupTable::Grid();
+    ParallelFor(0, height, ROWS_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            for (size_t y = 0; y < width; ++y) {
+                if (channels == 1) {
+                    image.GrayAt(x, y) = grid[medians[x * width + y]];
+                } else {
+                    image.At(x, y) = Image::Pixel(grid[medians[x * width + y]],
+                                                  grid[medians[(height + x) * width + y]],
+                                                  grid[medians[(2 * height + x) * width + y]]);
+                }
+            }
+        }
+    });
+}
+
+GaussianFilter::GaussianFilter(const long double& sigma, long double max_error)
+    : sigma_(std::abs(sigma)), max_error_(std::abs(max_error)) {
+    if (sigma_ != 0 && 4 * sigma_ < PRECOMPUTED_LENGTH) {
+        kernel_ = GetKernel(PRECOMPUTED_LENGTH);
+    }
+}
+
+size_t GaussianFilter::GetBandGrain() {
+    size_t tuned = Tuning::Get().band_grain;
+    return tuned != 0 ? tuned : BAND_GRAIN;
+}
+
+ssize_t GaussianFilter::GetRadius(size_t length) const {
+    auto radius = static_cast<ssize_t>(length);
+    if (4 * sigma_ < radius + 1) {
+        radius = static_cast<ssize_t>(std::ceil(3 * sigma_));
+    }
+    return radius;
+}
+
+std::vector<long double> GaussianFilter::GetKernel(size_t length) const {
+    if (sigma_ == 0) {
+        throw ProhibitedValue(std::to_string(sigma_), "<sigma>");
+    }
+    ssize_t radius = GetRadius(length);
+    // the weights only depend on the radius
+    if (static_cast<size_t>(2 * radius + 1) == kernel_.size()) {
+        return kernel_;
+    }
+    std::vector<long double> gauss(2 * radius + 1);
+    long double g_1 = std::pow(std::numbers::e_v<long double>, -1 / (2 * sigma_ * sigma_));
+    for (ssize_t i = -radius; i < radius + 1; ++i) {
+        gauss[i + radius] = std::pow(g_1, i * i);
+    }
+    return gauss;
+}
+
+size_t GaussianFilter::GetFootprint(size_t height, size_t width) const {
+    // the blocks of the pyramid are laid over the whole frame
+    if (GetLevel(height, width) > 0) {
+        return FULL_FRAME;
+    }
+    return std::max(GetRadius(height), GetRadius(width));
+}
+
+size_t GaussianFilter::GetLevel(size_t height, size_t width) const {
+    if (max_error_ == 0 || kernel_.empty()) {
+        return 0;
+    }
+    // the halved image keeps at least two pixels along each side, and lines longer than PRECOMPUTED_LENGTH gain
+    // nothing from deeper levels
+    size_t side = std::min({height, width, PRECOMPUTED_LENGTH});
+    size_t level = 0;
+    while ((size_t{4} << level) <= side && GetPyramidError(level + 1) <= max_error_) {
+        ++level;
+    }
+    return level;
+}
+
+long double GaussianFilter::GetPyramidSigma(size_t level) const {
+    // variances of the halvings and of the expansions, [1 4 6 4 1] / 16 having a variance of one pixel of its level
+    long double removed = 2 * (std::pow(4.0L, level) - 1) / 3;
+    if (sigma_ * sigma_ <= removed) {
+        return 0;
+    }
+    return std::sqrt(sigma_ * sigma_ - removed) / std::pow(2.0L, level);
+}
+
+long double GaussianFilter::GetPyramidError(size_t level) const {
+    // the error only depends on the sigma and the level, and takes longer the wider the blur: it is computed once
+    // per process, outside the lock, as filters of other threads may need other ones meanwhile
+    static std::mutex mutex;
+    static std::map<std::pair<long double, size_t>, long double> errors;
+    {
+        std::lock_guard lock(mutex);
+        if (auto found = errors.find({sigma_, level}); found != errors.end()) {
+            return found->second;
+        }
+    }
+    long double error = ComputePyramidError(level);
+    std::lock_guard lock(mutex);
+    errors.emplace(std::make_pair(sigma_, level), error);
+    return error;
+}
+
+long double GaussianFilter::ComputePyramidError(size_t level) const {
+    long double small_sigma = GetPyramidSigma(level);
+    if (small_sigma == 0) {
+        return std::numeric_limits<long double>::infinity();
+    }
+    auto normalize = [](std::vector<long double> kernel) {
+        long double sum = 0;
+        for (long double weight : kernel) {
+            sum += weight;
+        }
+        for (long double& weight : kernel) {
+            weight /= sum;
+        }
+        return kernel;
+    };
+    std::vector<long double> exact = normalize(GetKernel(PRECOMPUTED_LENGTH));
+    std::vector<long double> small = normalize(GaussianFilter(small_sigma).GetKernel(PRECOMPUTED_LENGTH));
+    size_t radius = exact.size() / 2;
+    size_t small_radius = small.size() / 2;
+    size_t factor = size_t{1} << level;
+    // a line long enough for no weight of the pixels in its middle block to reach its ends
+    size_t blocks = 2 * (small_radius + 4 + (radius + factor - 1) / factor);
+    size_t length = blocks * factor;
+    size_t origin = blocks / 2 * factor;
+    std::vector<Resampling> reductions;
+    std::vector<Resampling> expansions;
+    for (size_t i = 0; i < level; ++i) {
+        reductions.push_back(MakeReduction(length >> i));
+        expansions.push_back(MakeExpansion(length >> (i + 1), length >> i));
+    }
+    // the weights of the pixels in a row of the whole operator are its transpose applied to the pixel of that row;
+    // they are zero away from the pixel, which the loops skip
+    auto transpose = [](const Resampling& resampling, const std::vector<long double>& values, size_t length) {
+        std::vector<long double> result(length);
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (values[i] == 0) {
+                continue;
+            }
+            for (size_t k = 0; k < resampling.weights[i].size(); ++k) {
+                result[resampling.first[i] + k] += resampling.weights[i][k] * values[i];
+            }
+        }
+        return result;
+    };
+    long double error = 0;
+    size_t step = std::max<size_t>(1, factor / PYRAMID_PHASES);
+    for (size_t position = origin; position < origin + factor; position += step) {
+        std::vector<long double> weights(length);
+        weights[position] = 1;
+        for (size_t i = 0; i < level; ++i) {
+            weights = transpose(expansions[i], weights, length >> (i + 1));
+        }
+        std::vector<long double> blurred(weights.size());
+        for (size_t i = small_radius; i + small_radius < weights.size(); ++i) {
+            if (weights[i] == 0) {
+                continue;
+            }
+            for (size_t k = 0; k < small.size(); ++k) {
+                blurred[i + k - small_radius] += small[k] * weights[i];
+            }
+        }
+        weights = std::move(blurred);
+        for (size_t i = level; i > 0; --i) {
+            weights = transpose(reductions[i - 1], weights, length >> (i - 1));
+        }
+        for (size_t i = 0; i < exact.size(); ++i) {
+            weights[position + i - radius] -= exact[i];
+        }
+        long double distance = 0;
+        for (long double weight : weights) {
+            distance += std::abs(weight);
+        }
+        error = std::max(error, distance / 2);
+    }
+    // the blur of the rows adds to the one of the columns
+    return 2 * error;
+}
+
+template <typename V>
+void GaussianFilter::ApplyPyramid(Image& image, size_t level) const {
+    std::vector<std::pair<size_t, size_t>> sizes = {{image.GetHeight(), image.GetWidth()}};
+    std::vector<std::vector<V>> grid = ResampleGrid<V>(
+        image.GetHeight(), [&image](size_t x) { return std::as_const(image).Row<V>(x); },
+        MakeReduction(image.GetWidth()), MakeReduction(image.GetHeight()), GetBandGrain());
+    for (size_t i = 1; i < level; ++i) {
+        sizes.emplace_back(grid.size(), grid[0].size());
+        grid = ResampleGrid<V>(
+            grid.size(), [&grid](size_t x) { return std::span<const V>(grid[x]); }, MakeReduction(grid[0].size()),
+            MakeReduction(grid.size()), GetBandGrain());
+    }
+    auto [hor_res, ver_res] = image.GetRes();
+    Image small(std::move(grid), hor_res, ver_res);
+    GaussianFilter(GetPyramidSigma(level))(small);
+    auto row = [&small](size_t x) { return std::as_const(small).Row<V>(x); };
+    grid = ResampleGrid<V>(small.GetHeight(), row, MakeExpansion(small.GetWidth(), sizes.back().second),
+                           MakeExpansion(small.GetHeight(), sizes.back().first), GetBandGrain());
+    for (size_t i = level - 1; i > 0; --i) {
+        sizes.pop_back();
+        grid = ResampleGrid<V>(
+            grid.size(), [&grid](size_t x) { return std::span<const V>(grid[x]); },
+            MakeExpansion(grid[0].size(), sizes.back().second), MakeExpansion(grid.size(), sizes.back().first),
+            GetBandGrain());
+    }
+    ParallelFor(0, image.GetHeight(), GetBandGrain(), [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            std::copy(grid[x].begin(), grid[x].end(), image.Row<V>(x).begin());
+        }
+    });
+}
+
+template <typename V>
+void GaussianFilter::ComputeLine(std::span<V> line, std::vector<V>& prevs, const std::vector<long double>& gauss,
+                                 size_t y) const {
+    auto size = static_cast<ssize_t>(gauss.size() / 2);
+    V pixel{};
+    prevs[y] = line[y];
+    long double sum = 0;
+    for (ssize_t j = static_cast<ssize_t>(y) - size; j < static_cast<ssize_t>(y) + size + 1; ++j) {
+        if (j >= 0 && static_cast<size_t>(j) < line.size()) {
+            if (static_cast<size_t>(j) <= y) {
+                pixel += prevs[j] * gauss[j + size - y];
+            } else {
+                pixel += line[j] * gauss[j + size - y];
+            }
+            sum += gauss[j + size - y];
         }
     }
+    pixel = pixel / sum;
+    line[y] = pixel;
 }
 
-void ColorBurnFilter::ComputePixel(Image& image, size_t x, size_t y) {
-    if (x >= second_->GetHeight() || y >= second_->GetWidth()) {
+template <typename V>
+void GaussianFilter::BlurLines(Image& image, const std::vector<long double>& gauss, size_t begin, size_t end) const {
+    std::vector<V> prevs(image.GetWidth());
+    for (size_t i = begin; i < end; ++i) {
+        std::span<V> line = image.Row<V>(i);
+        for (size_t j = 0; j < line.size(); ++j) {
+            ComputeLine(line, prevs, gauss, j);
+        }
+    }
+}
+
+template <typename V>
+void GaussianFilter::BlurColumns(Image& image, const std::vector<long double>& gauss, size_t begin,
+                                 size_t end) const {
+    // the columns are blurred as the lines of a transposed copy of the band, with the reads along them contiguous
+    size_t height = image.GetHeight();
+    std::vector<std::span<V>> rows(height);
+    for (size_t i = 0; i < height; ++i) {
+        rows[i] = image.Row<V>(i);
+    }
+    std::vector<std::vector<V>> columns(end - begin, std::vector<V>(height));
+    TransposeBlocks(0, height, begin, end, [&](size_t x, size_t y) { columns[y - begin][x] = rows[x][y]; });
+    std::vector<V> prevs(height);
+    for (std::vector<V>& column : columns) {
+        for (size_t i = 0; i < height; ++i) {
+            ComputeLine(std::span<V>(column), prevs, gauss, i);
+        }
+    }
+    TransposeBlocks(0, end - begin, 0, height, [&](size_t x, size_t y) { rows[y][begin + x] = columns[x][y]; });
+}
+
+template <typename V>
+void GaussianFilter::Apply(Image& image) const {
+    if (image.GetHeight() == 0 || image.GetWidth() == 0) {
+        return;
+    }
+    // the kernel depends on the size of the whole frame, so windows of it are blurred the same way
+    auto [frame_height, frame_width] = image.GetFrameSize();
+    if (size_t level = GetLevel(frame_height, frame_width); level > 0) {
+        ApplyPyramid<V>(image, level);
         return;
+    }
+    size_t band_grain = GetBandGrain();
+    std::vector<long double> gauss = GetKernel(frame_width);
+    ParallelFor(0, image.GetHeight(), band_grain,
+                [&](size_t begin, size_t end) { BlurLines<V>(image, gauss, begin, end); });
+    gauss = GetKernel(frame_height);
+    // a band of columns at a time, so the transposed copies take a band per thread instead of the whole image
+    ParallelFor(0, image.GetWidth(), band_grain, [&](size_t begin, size_t end) {
+        for (size_t band = begin; band < end; band += band_grain) {
+            BlurColumns<V>(image, gauss, band, std::min(end, band + band_grain));
+        }
+    });
+}
+
+size_t GaussianFilter::GetWorkspace(size_t height, size_t width, Image::Format format) const {
+    if (GetLevel(height, width) > 0) {
+        // the first halving along the rows is the largest level, half the image
+        return Image::GetBytes(height, width, format) * 2;
+    }
+    return GetThreadCount() * Image::GetBytes(GetBandGrain() + 1, std::max(height, width), format);
+}
+
+long double GaussianFilter::GetCost(size_t height, size_t width, Image::Format format) const {
+    size_t level = GetLevel(height, width);
+    long double sigma = level == 0 ? sigma_ : GetPyramidSigma(level);
+    // the kernel covers 3 sigma on each side, or the whole line
+    auto taps = [sigma](size_t length) {
+        return std::min(2 * std::ceil(3 * sigma) + 1, static_cast<long double>(2 * length + 1));
     };
-    Image::Pixel base = image.At(x, y);
-    Image::Pixel added = second_->At(x, y);
-    Burn(base.red, added.red);
-    Burn(base.green, added.green);
-    Burn(base.blue, added.blue);
-    image.At(x, y) = base;
+    size_t level_height = std::max<size_t>(height >> level, 1);
+    size_t level_width = std::max<size_t>(width >> level, 1);
+    long double cost = level == 0 ? PerPixel(height, width, format, 0, 40) : PerPixel(height, width, format, 230, 80);
+    if (sigma != 0) {
+        cost += PerPixel(level_height, level_width, format, 38, 2.2L) * (taps(level_width) + taps(level_height));
+    }
+    return cost / GetThreadCount();
 }
 
-void SketchFilter::operator()(Image& image) {
-    GrayscaleFilter{}(image);
-    std::shared_ptr<Image> second(std::make_shared<Image>(image));
-    NegativeFilter{}(*second);
-    GaussianFilter{sigma_}(*second);
-    ColorDodgeFilter{second}(image);
+void GaussianFilter::operator()(Image& image) const {
+    if (image.IsGray()) {
+        Apply<long double>(image);
+    } else {
+        Apply<Image::Pixel>(image);
+    }
 }
 
-void ChalkFilter::operator()(Image& image) {
+namespace {
+// rows or columns per task of the graph below
+const size_t BAND_SIZE = 64;
+
+// blends the grayscale image with its blurred negative. The steps run as a graph over bands of rows: each band is
+// negated and blurred along its rows as soon as the grayscale image is ready, the blur across the rows runs on bands
+// of columns once all the rows are done, and the blend of a band of rows waits for all of those
+template <typename TMode>
+void BlendWithBlurredNegative(Image& image, const GaussianFilter& gaussian) {
     GrayscaleFilter{}(image);
-    std::shared_ptr<Image> second(std::make_shared<Image>(image));
-    NegativeFilter{}(*second);
-    GaussianFilter{sigma_}(*second);
-    ColorBurnFilter{second}(image);
-}
\ No newline at end of file
+    size_t height = image.GetHeight();
+    size_t width = image.GetWidth();
+    if (height == 0 || width == 0) {
+        return;
+    }
+    auto [frame_height, frame_width] = image.GetFrameSize();
+    if (gaussian.GetLevel(frame_height, frame_width) > 0) {
+        // the approximate blur works on the whole image at once
+        Image second = image;
+        NegativeFilter{}(second);
+        gaussian(second);
+        ParallelFor(0, height, BAND_SIZE, [&](size_t begin, size_t end) {
+            for (size_t x = begin; x < end; ++x) {
+                std::span<long double> base = image.GrayRow(x);
+                std::span<const long double> blend = second.GrayRow(x);
+                for (size_t y = 0; y < width; ++y) {
+                    base[y] = TMode::Blend(base[y], blend[y]);
+                }
+            }
+        });
+        return;
+    }
+    std::vector<long double> line_kernel = gaussian.GetKernel(frame_width);
+    std::vector<long double> column_kernel = gaussian.GetKernel(frame_height);
+    auto [hor_res, ver_res] = image.GetRes();
+    Image second(Image::GrayGrid(height, std::vector<long double>(width)), hor_res, ver_res);
+    NegativeFilter negative;
+
+    TaskGraph graph;
+    std::vector<TaskGraph::Task> lines;
+    for (size_t begin = 0; begin < height; begin += BAND_SIZE) {
+        size_t end = std::min(height, begin + BAND_SIZE);
+        TaskGraph::Task negated = graph.Add([&, begin, end]() {
+            for (size_t x = begin; x < end; ++x) {
+                std::span<const long double> source = image.GrayRow(x);
+                std::span<long double> target = second.GrayRow(x);
+                for (size_t y = 0; y < width; ++y) {
+                    target[y] = negative.Map(source[y]);
+                }
+            }
+        });
+        lines.push_back(graph.Add(
+            [&, begin, end]() { gaussian.BlurLines<long double>(second, line_kernel, begin, end); }, {negated}));
+    }
+    std::vector<TaskGraph::Task> columns;
+    for (size_t begin = 0; begin < width; begin += BAND_SIZE) {
+        size_t end = std::min(width, begin + BAND_SIZE);
+        columns.push_back(graph.Add(
+            [&, begin, end]() { gaussian.BlurColumns<long double>(second, column_kernel, begin, end); }, lines));
+    }
+    for (size_t begin = 0; begin < height; begin += BAND_SIZE) {
+        size_t end = std::min(height, begin + BAND_SIZE);
+        graph.Add(
+            [&, begin, end]() {
+                for (size_t x = begin; x < end; ++x) {
+                    std::span<long double> base = image.GrayRow(x);
+                    std::span<const long double> blend = second.GrayRow(x);
+                    for (size_t y = 0; y < width; ++y) {
+                        base[y] = TMode::Blend(base[y], blend[y]);
+                    }
+                }
+            },
+            columns);
+    }
+    graph.Run();
+}
+
+// the luminance plane of RGB images, and then the blurred negative beside the image
+size_t GetBlurredNegativeWorkspace(const GaussianFilter& gaussian, size_t height, size_t width, Image::Format format) {
+    size_t luma = format == Image::Format::GRAY ? 0 : Image::GetBytes(height, width, Image::Format::GRAY);
+    return luma + Image::GetBytes(height, width, Image::Format::GRAY) +
+           gaussian.GetWorkspace(height, width, Image::Format::GRAY);
+}
+
+// the luminance of RGB images, the blur of the negative and the blend
+long double GetBlurredNegativeCost(const GaussianFilter& gaussian, size_t height, size_t width, Image::Format format) {
+    long double luma = format == Image::Format::GRAY ? 0 : GrayscaleFilter{}.GetCost(height, width, format);
+    return luma + gaussian.GetCost(height, width, Image::Format::GRAY) +
+           NegativeFilter{}.GetCost(height, width, Image::Format::GRAY) / GetThreadCount();
+}
+}  // namespace
+
+void SketchFilter::operator()(Image& image) const {
+    BlendWithBlurredNegative<ColorDodgeFilter>(image, blur_);
+}
+
+void ChalkFilter::operator()(Image& image) const {
+    BlendWithBlurredNegative<ColorBurnFilter>(image, blur_);
+}
+
+size_t SketchFilter::GetWorkspace(size_t height, size_t width, Image::Format format) const {
+    return GetBlurredNegativeWorkspace(blur_, height, width, format);
+}
+
+size_t ChalkFilter::GetWorkspace(size_t height, size_t width, Image::Format format) const {
+    return GetBlurredNegativeWorkspace(blur_, height, width, format);
+}
+
+long double SketchFilter::GetCost(size_t height, size_t width, Image::Format format) const {
+    return GetBlurredNegativeCost(blur_, height, width, format);
+}
+
+long double ChalkFilter::GetCost(size_t height, size_t width, Image::Format format) const {
+    return GetBlurredNegativeCost(blur_, height, width, format);
+}
+
+size_t SketchFilter::GetFootprint(size_t height, size_t width) const {
+    return blur_.GetFootprint(height, width);
+}
+
+size_t ChalkFilter::GetFootprint(size_t height, size_t width) const {
+    return blur_.GetFootprint(height, width);
+}
+
+void RunFilter(const Filter& filter, Image& image) {
+    try {
+        filter(image);
+    } catch (FilterException& e) {
+        e.SetFilter(filter.GetName());
+        throw e;
+    } catch (const std::exception& e) {
+        throw BrokenFilter(filter.GetName());
+    }
+}
+
+std::string MakeKey(const std::string& name, const std::vector<long double>& arguments) {
+    std::ostringstream key;
+    key << name << '(' << std::hexfloat;
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        key << (i == 0 ? "" : ", ") << arguments[i];
+    }
+    key << ')';
+    return key.str();
+}
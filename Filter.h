@@ -1,23 +1,70 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <limits>
+#include <string>
 #include <vector>
 #include <memory>
 
 #include "Image.h"
+#include "LookupTable.h"
+#include "Parallel.h"
 
 class Filter {
 private:
     inline static const std::string NAME = "Filter";
 
 public:
+    // footprint of filters that need the whole image or change its size
+    inline static const size_t FULL_FRAME = std::numeric_limits<size_t>::max();
+
     virtual const std::string& GetName() const {
         return NAME;
     };
-    virtual void operator()(Image& image) = 0;
+    virtual void operator()(Image& image) const = 0;
+    // how far from a pixel, in pixels, the filter reads to compute it in a frame of the given size; windows of a
+    // frame extended by the footprint give the same result inside as the whole frame
+    virtual size_t GetFootprint(size_t height, size_t width) const {
+        return FULL_FRAME;
+    }
+    // height and width the filter gives an image of the given size
+    virtual std::pair<size_t, size_t> GetSize(size_t height, size_t width) const {
+        return {height, width};
+    }
+    // the format the filter leaves an image of the given format in
+    virtual Image::Format GetFormat(Image::Format format) const {
+        return format;
+    }
+    // the most bytes the filter allocates besides the image while it runs on an image of the given size and format,
+    // a copy of the image unless the filter knows better; the alpha plane is left out
+    virtual size_t GetWorkspace(size_t height, size_t width, Image::Format format) const {
+        return Image::GetBytes(height, width, format);
+    }
+    // rough nanoseconds the filter takes on an image of the given size and format with the threads it runs on, as
+    // measured on a reference machine; a serial pass over the pixels unless the filter knows better
+    virtual long double GetCost(size_t height, size_t width, Image::Format format) const {
+        return PerPixel(height, width, format, 40, 20);
+    }
+    // the name of the filter with its arguments; filters with the same key give the same results
+    virtual std::string GetKey() const {
+        return GetName();
+    }
     virtual ~Filter() = default;
+
+protected:
+    // the given cost per pixel of an RGB or a GRAY image of the given size, for GetCost()
+    static long double PerPixel(size_t height, size_t width, Image::Format format, long double rgb, long double gray) {
+        return static_cast<long double>(height) * width * (format == Image::Format::GRAY ? gray : rgb);
+    }
 };
 
+// runs the filter, naming it in the errors it throws
+void RunFilter(const Filter& filter, Image& image);
+
+// name(arguments), with floating point arguments written exactly
+std::string MakeKey(const std::string& name, const std::vector<long double>& arguments);
+
 class CropFilter : public Filter {
 private:
     inline static const std::string NAME = "CropFilter";
@@ -28,108 +75,361 @@ public:
         return NAME;
     }
     CropFilter(size_t width, size_t height) : new_height_(height), new_width_(width){};
-    void operator()(Image& image) override;
+    std::string GetKey() const override {
+        return MakeKey(NAME, {static_cast<long double>(new_width_), static_cast<long double>(new_height_)});
+    }
+    std::pair<size_t, size_t> GetSize(size_t height, size_t width) const override {
+        return {std::min(new_height_, height), std::min(new_width_, width)};
+    }
+    // the rows are shortened in place
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return 0;
+    }
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        auto [new_height, new_width] = GetSize(height, width);
+        return PerPixel(new_height, new_width, format, 4, 2);
+    }
+    void operator()(Image& image) const override;
+};
+
+// resamples the image to the given size, averaging blocks of pixels along the sides that shrink by a whole factor
+// and using a separable Lanczos kernel, widened to cover every source pixel of an output pixel when shrinking, along
+// the rest; the alpha plane is resampled with the pixels
+class ResizeFilter : public Filter {
+private:
+    inline static const std::string NAME = "ResizeFilter";
+    inline static const size_t ROWS_GRAIN = 16;
+    size_t new_height_, new_width_;
+
+    template <typename V>
+    static std::vector<std::vector<V>> Resample(const Image& image, size_t new_height, size_t new_width);
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    ResizeFilter(size_t width, size_t height) : new_height_(height), new_width_(width){};
+    std::string GetKey() const override {
+        return MakeKey(NAME, {static_cast<long double>(new_width_), static_cast<long double>(new_height_)});
+    }
+    std::pair<size_t, size_t> GetSize(size_t height, size_t width) const override;
+    // the result and the image resampled along one side
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override;
+    long double GetCost(size_t height, size_t width, Image::Format format) const override;
+    void operator()(Image& image) const override;
+};
+
+// shrinks the image to fit in a square with the given side, keeping its proportions; smaller images are left as
+// they are
+class ThumbnailFilter : public ResizeFilter {
+private:
+    inline static const std::string NAME = "ThumbnailFilter";
+    size_t size_;
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    explicit ThumbnailFilter(size_t size) : ResizeFilter(size, size), size_(size){};
+    std::string GetKey() const override {
+        return MakeKey(NAME, {static_cast<long double>(size_)});
+    }
+    std::pair<size_t, size_t> GetSize(size_t height, size_t width) const override;
+    void operator()(Image& image) const override;
+};
+
+// turns the image clockwise by 90, 180 or 270 degrees, with its alpha plane. Quarter turns are blocked transposes
+// reading the rows of the image, or writing those of the result, from the last one; the half turn flips the image
+// both ways in place
+class RotateFilter : public Filter {
+private:
+    inline static const std::string NAME = "RotateFilter";
+    inline static const size_t ROWS_GRAIN = 16;
+    size_t degrees_;
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    explicit RotateFilter(size_t degrees) : degrees_(degrees){};
+    std::string GetKey() const override {
+        return MakeKey(NAME, {static_cast<long double>(degrees_)});
+    }
+    std::pair<size_t, size_t> GetSize(size_t height, size_t width) const override;
+    // quarter turns make the transpose beside the image, the half turn works in place
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return degrees_ == 180 ? 0 : Image::GetBytes(height, width, format);
+    }
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        return PerPixel(height, width, format, 45, 20) / (degrees_ == 180 ? 1 : GetThreadCount());
+    }
+    void operator()(Image& image) const override;
+};
+
+// turns the image upside down by reversing the order of its rows, which moves no pixels
+class FlipVerticalFilter : public Filter {
+private:
+    inline static const std::string NAME = "FlipVerticalFilter";
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return 0;
+    }
+    void operator()(Image& image) const override;
+};
+
+// mirrors the image left to right, reversing its rows in place
+class FlipHorizontalFilter : public Filter {
+private:
+    inline static const std::string NAME = "FlipHorizontalFilter";
+    inline static const size_t ROWS_GRAIN = 16;
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return 0;
+    }
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        return PerPixel(height, width, format, 40, 20) / GetThreadCount();
+    }
+    void operator()(Image& image) const override;
 };
 
 class ByPixelFilter : public Filter {
 private:
     inline static const std::string NAME = "ByPixelFilter";
-    virtual void ComputePixel(Image& image, size_t x, size_t y) = 0;
+    virtual void ComputePixel(Image& image, size_t x, size_t y) const = 0;
+    // used instead of ComputePixel on GRAY images if SupportsGray() returns true
+    virtual void ComputeGrayPixel(Image& image, size_t x, size_t y) const {};
+    virtual bool SupportsGray() const {
+        return false;
+    }
 
 public:
     const std::string& GetName() const override {
         return NAME;
     }
-    void operator()(Image& image) override;
+    size_t GetFootprint(size_t height, size_t width) const override {
+        return 0;
+    }
+    // GRAY images are expanded to RGB unless the filter supports them
+    Image::Format GetFormat(Image::Format format) const override {
+        return SupportsGray() ? format : Image::Format::RGB;
+    }
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return GetFormat(format) == format ? 0 : Image::GetBytes(height, width, Image::Format::RGB);
+    }
+    void operator()(Image& image) const override;
 };
 
-class GrayscaleFilter : public ByPixelFilter {
+// a function of a single value: applied to every channel of RGB images, unless the filter reduces them to
+// GRAY by combining the channels
+class PointFilter : public ByPixelFilter {
+private:
+    inline static const std::string NAME = "PointFilter";
+    void ComputePixel(Image& image, size_t x, size_t y) const override;
+    void ComputeGrayPixel(Image& image, size_t x, size_t y) const override;
+    bool SupportsGray() const override {
+        return true;
+    }
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    virtual long double Map(long double value) const = 0;
+    virtual bool ReducesToGray() const {
+        return false;
+    }
+    virtual long double Reduce(const Image::Pixel& pixel) const {
+        return Map(pixel.red);
+    }
+    Image::Format GetFormat(Image::Format format) const override {
+        return ReducesToGray() ? Image::Format::GRAY : format;
+    }
+    // the luminance plane of RGB images reduced to GRAY
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return GetFormat(format) == format ? 0 : Image::GetBytes(height, width, Image::Format::GRAY);
+    }
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        return PerPixel(height, width, format, 30, 12);
+    }
+    void operator()(Image& image) const override;
+};
+
+// leaves the image in GRAY format
+class GrayscaleFilter : public PointFilter {
 private:
     inline static const std::string NAME = "GrayscaleFilter";
     inline static const long double RED_MULT = 0.299;
     inline static const long double GREEN_MULT = 0.587;
     inline static const long double BLUE_MULT = 0.114;
-    void ComputePixel(Image& image, size_t x, size_t y) override;
 
 public:
     const std::string& GetName() const override {
         return NAME;
     }
+    static long double Luma(const Image::Pixel& pixel) {
+        return RED_MULT * pixel.red + GREEN_MULT * pixel.green + BLUE_MULT * pixel.blue;
+    }
+    static long double Luma(long double value) {
+        return RED_MULT * value + GREEN_MULT * value + BLUE_MULT * value;
+    }
+    long double Map(long double value) const override {
+        return Luma(value);
+    }
+    bool ReducesToGray() const override {
+        return true;
+    }
+    long double Reduce(const Image::Pixel& pixel) const override {
+        return Luma(pixel);
+    }
 };
 
-class NegativeFilter : public ByPixelFilter {
+class NegativeFilter : public PointFilter {
 private:
     inline static const std::string NAME = "NegativeFilter";
-    void ComputePixel(Image& image, size_t x, size_t y) override;
 
 public:
     const std::string& GetName() const override {
         return NAME;
     }
+    long double Map(long double value) const override {
+        return 1 - value;
+    }
 };
 
-template <typename T>
-class MatrixFilter : public ByPixelFilter {
+// a chain of point filters run as a single pass; the stages before the first one reducing RGB images to GRAY
+// are compiled into one lookup table per channel, the rest into one table for the luminance
+class LutFilter : public Filter {
 private:
-    inline static const std::string NAME = "MatrixFilter";
-    std::array<std::array<T, 3>, 3> matrix_;
-    std::vector<Image::Pixel> prev_line_, cur_line_;
+    inline static const std::string NAME = "LutFilter";
+    std::vector<std::unique_ptr<PointFilter>> stages_;
+    // index of the first stage reducing RGB images to GRAY, the number of stages if there is none
+    size_t reduce_;
+    // the whole chain for GRAY images, the stages before reduce_ for the channels of RGB images and the ones after
+    // it for their luminance; all of them are built once, when the filter is made
+    LookupTable gray_;
+    LookupTable channel_;
+    LookupTable luma_;
+
+    size_t FindReduce() const;
+    LookupTable Compile(size_t begin, size_t end) const;
 
 public:
     const std::string& GetName() const override {
         return NAME;
     }
-    explicit MatrixFilter(const std::array<std::array<T, 3>, 3>& matrix) : matrix_(matrix){};
-    void ComputePixel(Image& image, size_t x, size_t y) override {
-        if (image.GetHeight() == 0) {
-            return;
+    explicit LutFilter(std::vector<std::unique_ptr<PointFilter>> stages)
+        : stages_(std::move(stages)),
+          reduce_(FindReduce()),
+          gray_(Compile(0, stages_.size())),
+          channel_(Compile(0, reduce_)),
+          luma_(Compile(std::min(reduce_ + 1, stages_.size()), stages_.size())){};
+    size_t GetFootprint(size_t height, size_t width) const override {
+        return 0;
+    }
+    Image::Format GetFormat(Image::Format format) const override {
+        return reduce_ < stages_.size() ? Image::Format::GRAY : format;
+    }
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return GetFormat(format) == format ? 0 : Image::GetBytes(height, width, Image::Format::GRAY);
+    }
+    // a lookup per value, whatever the number of stages
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        return PerPixel(height, width, format, 30, 12);
+    }
+    std::string GetKey() const override;
+    void operator()(Image& image) const override;
+};
+
+template <typename T>
+class MatrixFilter : public Filter {
+private:
+    inline static const std::string NAME = "MatrixFilter";
+    std::array<std::array<T, 3>, 3> matrix_;
+
+    static void Clamp(long double& value) {
+        if (value < 0) {
+            value = 0;
         }
-        Image::Pixel pixel;
-        if (y == 0) {
-            std::swap(prev_line_, cur_line_);
-            if (x < 2) {
-                cur_line_.resize(image.GetWidth());
-            }
+        if (value > 1) {
+            value = 1;
         }
-        cur_line_[y] = image.At(x, y);
-        for (size_t i = 0; i < 3; ++i) {
-            for (size_t j = 0; j < 3; ++j) {
-                size_t coord_x = (x + i > 0) ? x + i : 1;
-                coord_x = (coord_x <= image.GetHeight()) ? coord_x : image.GetHeight();
-                size_t coord_y = (y + j > 0) ? y + j : 1;
-                coord_y = (coord_y <= image.GetWidth()) ? coord_y : image.GetWidth();
-                --coord_x;
-                --coord_y;
-                if (coord_x < x) {
-                    pixel += prev_line_[coord_y] * matrix_[i][j];
-                } else if (coord_x > x || coord_y > y) {
-                    pixel += image.At(coord_x, coord_y) * matrix_[i][j];
-                } else {
-                    pixel += cur_line_[coord_y] * matrix_[i][j];
+    }
+
+    static void Clamp(Image::Pixel& pixel) {
+        Clamp(pixel.red);
+        Clamp(pixel.green);
+        Clamp(pixel.blue);
+    }
+
+    // V is Image::Pixel for RGB images and long double for GRAY ones
+    template <typename V>
+    void Apply(Image& image) const {
+        std::vector<V> prev_line(image.GetWidth());
+        std::vector<V> cur_line(image.GetWidth());
+        for (size_t x = 0; x < image.GetHeight(); ++x) {
+            std::swap(prev_line, cur_line);
+            for (size_t y = 0; y < image.GetWidth(); ++y) {
+                V value{};
+                cur_line[y] = image.Value<V>(x, y);
+                for (size_t i = 0; i < 3; ++i) {
+                    for (size_t j = 0; j < 3; ++j) {
+                        size_t coord_x = (x + i > 0) ? x + i : 1;
+                        coord_x = (coord_x <= image.GetHeight()) ? coord_x : image.GetHeight();
+                        size_t coord_y = (y + j > 0) ? y + j : 1;
+                        coord_y = (coord_y <= image.GetWidth()) ? coord_y : image.GetWidth();
+                        --coord_x;
+                        --coord_y;
+                        if (coord_x < x) {
+                            value += prev_line[coord_y] * matrix_[i][j];
+                        } else if (coord_x > x || coord_y > y) {
+                            value += image.Value<V>(coord_x, coord_y) * matrix_[i][j];
+                        } else {
+                            value += cur_line[coord_y] * matrix_[i][j];
+                        }
+                    }
                 }
+                Clamp(value);
+                image.Value<V>(x, y) = value;
             }
         }
+    }
 
-        if (pixel.red < 0) {
-            pixel.red = 0;
-        }
-        if (pixel.red > 1) {
-            pixel.red = 1;
-        }
-        if (pixel.green < 0) {
-            pixel.green = 0;
-        }
-        if (pixel.green > 1) {
-            pixel.green = 1;
-        }
-        if (pixel.blue < 0) {
-            pixel.blue = 0;
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    explicit MatrixFilter(const std::array<std::array<T, 3>, 3>& matrix) : matrix_(matrix){};
+    size_t GetFootprint(size_t height, size_t width) const override {
+        return 1;
+    }
+    // the two lines kept unfiltered
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return Image::GetBytes(2, width, format);
+    }
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        return PerPixel(height, width, format, 335, 135);
+    }
+    std::string GetKey() const override {
+        std::vector<long double> arguments;
+        for (const std::array<T, 3>& row : matrix_) {
+            arguments.insert(arguments.end(), row.begin(), row.end());
         }
-        if (pixel.blue > 1) {
-            pixel.blue = 1;
+        return MakeKey(GetName(), arguments);
+    }
+    void operator()(Image& image) const override {
+        if (image.IsGray()) {
+            Apply<long double>(image);
+        } else {
+            Apply<Image::Pixel>(image);
         }
-
-        image.At(x, y) = pixel;
     }
 };
 
@@ -156,7 +456,7 @@ private:
 public:
     explicit QueueFilter(const THead& last_filter, const TTail&... next_filters)
         : QueueFilter<TTail...>(next_filters...), first_filter_(last_filter){};
-    void operator()(Image& image) override {
+    void operator()(Image& image) const override {
         first_filter_(image);
         QueueFilter<TTail...>::operator()(image);
     }
@@ -171,10 +471,11 @@ public:
     const std::string& GetName() const override {
         return NAME;
     }
-    void operator()(Image& image) override{};
+    void operator()(Image& image) const override{};
 };
 
-class ThresholdFilter : public ByPixelFilter {
+// leaves the image in GRAY format
+class ThresholdFilter : public PointFilter {
 private:
     inline static const std::string NAME = "ThresholdFilter";
     long double threshold_;
@@ -184,90 +485,432 @@ public:
         return NAME;
     }
     explicit ThresholdFilter(long double threshold) : threshold_(threshold){};
-    void ComputePixel(Image& image, size_t x, size_t y) override;
+    std::string GetKey() const override {
+        return MakeKey(NAME, {threshold_});
+    }
+    long double Map(long double value) const override {
+        return value > threshold_;
+    }
+    bool ReducesToGray() const override {
+        return true;
+    }
+    long double Reduce(const Image::Pixel& pixel) const override {
+        return (pixel.red > threshold_) && (pixel.green > threshold_) && (pixel.blue > threshold_);
+    }
+};
+
+// ThresholdFilter with the threshold Otsu's method gives for the luminance histogram of the image, which is converted
+// to its luminance first; leaves the image in GRAY format
+class OtsuThresholdFilter : public Filter {
+private:
+    inline static const std::string NAME = "OtsuThresholdFilter";
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    Image::Format GetFormat(Image::Format format) const override {
+        return Image::Format::GRAY;
+    }
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return format == Image::Format::GRAY ? 0 : Image::GetBytes(height, width, Image::Format::GRAY);
+    }
+    void operator()(Image& image) const override;
 };
 
-class EdgeDetectionFilter : public QueueFilter<GrayscaleFilter, MatrixFilter<char>, ThresholdFilter> {
+// compares the pixels with the mean of the square of side 2 * radius + 1 around them, less the offset, instead of a
+// fixed threshold; the means come from an IntegralImage, in constant time per pixel. Leaves the image in GRAY format
+class AdaptiveThresholdFilter : public Filter {
+private:
+    inline static const std::string NAME = "AdaptiveThresholdFilter";
+    inline static const size_t ROWS_GRAIN = 16;
+    size_t radius_;
+    long double offset_;
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    AdaptiveThresholdFilter(size_t radius, long double offset) : radius_(radius), offset_(offset){};
+    size_t GetFootprint(size_t height, size_t width) const override {
+        return radius_;
+    }
+    Image::Format GetFormat(Image::Format format) const override {
+        return Image::Format::GRAY;
+    }
+    // the integral image and the result
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override;
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        return PerPixel(height, width, format, 130, 50) / GetThreadCount();
+    }
+    std::string GetKey() const override {
+        return MakeKey(NAME, {static_cast<long double>(radius_), offset_});
+    }
+    void operator()(Image& image) const override;
+};
+
+// grayscale, the {{0, -1, 0}, {-1, 4, -1}, {0, -1, 0}} convolution and the threshold fused into one pass
+// over a window of three luminance rows; leaves the image in GRAY format
+class EdgeDetectionFilter : public Filter {
 private:
     inline static const std::string NAME = "EdgeDetectionFilter";
-    inline static const std::array<std::array<char, 3>, 3> EDGE_MATRIX = {{{0, -1, 0}, {-1, 4, -1}, {0, -1, 0}}};
+    long double threshold_ = 0;
+    // whether the threshold is the one Otsu's method gives for the convolution of the whole image
+    bool automatic_ = false;
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    explicit EdgeDetectionFilter(long double threshold) : threshold_(threshold){};
+    // picks the threshold with Otsu's method
+    EdgeDetectionFilter() : automatic_(true){};
+    size_t GetFootprint(size_t height, size_t width) const override {
+        return automatic_ ? FULL_FRAME : 1;
+    }
+    Image::Format GetFormat(Image::Format format) const override {
+        return Image::Format::GRAY;
+    }
+    // the result and the three luminance lines
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return Image::GetBytes(height + 3, width, Image::Format::GRAY);
+    }
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        return PerPixel(height, width, format, 30, 20);
+    }
+    std::string GetKey() const override {
+        return automatic_ ? NAME + "(auto)" : MakeKey(NAME, {threshold_});
+    }
+    void operator()(Image& image) const override;
+};
+
+// replaces every pixel with the mean of the square of side 2 * radius + 1 around it, or of its part inside the image,
+// taken from an IntegralImage in constant time per pixel whatever the radius
+class BoxFilter : public Filter {
+private:
+    inline static const std::string NAME = "BoxFilter";
+    inline static const size_t ROWS_GRAIN = 16;
+    size_t radius_;
 
 public:
     const std::string& GetName() const override {
         return NAME;
     }
-    explicit EdgeDetectionFilter(long double threshold)
-        : QueueFilter<GrayscaleFilter, MatrixFilter<char>, ThresholdFilter>(
-              GrayscaleFilter(), MatrixFilter<char>(EDGE_MATRIX), ThresholdFilter(threshold)){};
+    explicit BoxFilter(size_t radius) : radius_(radius){};
+    size_t GetFootprint(size_t height, size_t width) const override {
+        return radius_;
+    }
+    // the integral image
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override;
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        return PerPixel(height, width, format, 100, 40) / GetThreadCount();
+    }
+    std::string GetKey() const override {
+        return MakeKey(NAME, {static_cast<long double>(radius_)});
+    }
+    void operator()(Image& image) const override;
 };
 
+// replaces every channel of a pixel with its median over the square of side 2 * radius + 1 around it, the pixels
+// beyond the borders repeating the nearest ones as in MatrixFilter. Values are rounded to 8 bits first, which leaves
+// those read from 8-bit files as they are; a 3x3 square goes through a sorting network, larger ones through sliding
+// histograms of the columns (Perreault and Hebert) in constant time per pixel, on bands of columns in parallel
+class MedianFilter : public Filter {
+private:
+    inline static const std::string NAME = "MedianFilter";
+    inline static const size_t ROWS_GRAIN = 16;
+    inline static const size_t COLUMNS_GRAIN = 64;
+    size_t radius_;
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    explicit MedianFilter(size_t radius) : radius_(radius){};
+    size_t GetFootprint(size_t height, size_t width) const override {
+        return radius_;
+    }
+    // the levels of the channels and their medians, a byte each
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return 2 * (format == Image::Format::GRAY ? 1 : 3) * height * width;
+    }
+    // the histograms of the columns are updated in constant time, but merging them grows with the radius
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        if (radius_ <= 1) {
+            return PerPixel(height, width, format, 230, 80) / GetThreadCount();
+        }
+        return PerPixel(height, width, format, 300 + 45 * radius_, 100 + 13 * radius_) / GetThreadCount();
+    }
+    std::string GetKey() const override {
+        return MakeKey(NAME, {static_cast<long double>(radius_)});
+    }
+    void operator()(Image& image) const override;
+};
+
+// with a nonzero max_error, blurs wide enough are computed within max_error of the exact blur, away from the borders,
+// through a Gaussian pyramid: the image is halved level times, blurred with the rest of the variance and expanded back
 class GaussianFilter : public Filter {
 private:
     inline static const std::string NAME = "ByLineFilter";
-    std::vector<long double> gauss_;
-    std::vector<Image::Pixel> prevs_;
+    inline static const size_t BAND_GRAIN = 32;
+    inline static const size_t PRECOMPUTED_LENGTH = 1 << 16;
+    // positions in a block of the deepest level the error of a level is checked at
+    inline static const size_t PYRAMID_PHASES = 64;
     long double sigma_;
-    ssize_t size_;
-
-    void ComputeLine(Image& image, size_t line, size_t y);
-    void ComputeRow(Image& image, size_t x, size_t row);
+    long double max_error_;
+    // the kernel of lines long enough to cover 3 sigma, which all but the smallest images use; empty for sigmas too
+    // large for lines of PRECOMPUTED_LENGTH, which are always blurred exactly
+    std::vector<long double> kernel_;
+
+    // the kernel covers 3 sigma, or the whole line if that is not much longer
+    ssize_t GetRadius(size_t length) const;
+    // blurs the value y of the line, whose earlier values are already blurred and kept unblurred in prevs
+    template <typename V>
+    void ComputeLine(std::span<V> line, std::vector<V>& prevs, const std::vector<long double>& gauss, size_t y) const;
+    template <typename V>
+    void Apply(Image& image) const;
+
+    // sigma of the blur at the given level, in its pixels; 0 if halving and expanding alone are wider than the blur
+    long double GetPyramidSigma(size_t level) const;
+    // bound of the difference between the exact blur and the one through the given level for images with values in
+    // [0, 1]: half the L1 distance between the weights the two give the pixels, along each of the two axes
+    long double ComputePyramidError(size_t level) const;
+    // the same, computed once per sigma and level
+    long double GetPyramidError(size_t level) const;
+    template <typename V>
+    void ApplyPyramid(Image& image, size_t level) const;
 
 public:
     const std::string& GetName() const override {
         return NAME;
     }
-    void operator()(Image& image) override;
-    explicit GaussianFilter(const long double& sigma) : sigma_(std::abs(sigma)){};
+    size_t GetFootprint(size_t height, size_t width) const override;
+    // a band of columns and a line per thread for the exact blur, the levels of the pyramid and the image expanded
+    // back for the approximate one
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override;
+    // the kernel taps of both passes, at the deepest level for the approximate blur, which adds the halvings and
+    // expansions
+    long double GetCost(size_t height, size_t width, Image::Format format) const override;
+    std::string GetKey() const override {
+        if (max_error_ == 0) {
+            return MakeKey(NAME, {sigma_});
+        }
+        return MakeKey(NAME, {sigma_, max_error_});
+    }
+
+    // rows or columns per band of the passes, BAND_GRAIN unless --tune picked another
+    static size_t GetBandGrain();
+
+    // how many times the blur of a frame of the given size halves it, 0 for the exact blur
+    size_t GetLevel(size_t height, size_t width) const;
+
+    // kernel for lines of the given length in the frame
+    std::vector<long double> GetKernel(size_t length) const;
+
+    // the two passes of the blur, over lines [begin, end) with the kernel for the frame width and then over
+    // columns [begin, end) with the kernel for the frame height; the bands of a pass are independent
+    template <typename V>
+    void BlurLines(Image& image, const std::vector<long double>& gauss, size_t begin, size_t end) const;
+    template <typename V>
+    void BlurColumns(Image& image, const std::vector<long double>& gauss, size_t begin, size_t end) const;
+
+    void operator()(Image& image) const override;
+    explicit GaussianFilter(const long double& sigma, long double max_error = 0);
+};
+
+// blends the overlap of the image and a second one channel by channel with TMode::Blend(base, blend); pixels
+// outside the overlap are left as they are
+template <typename TMode>
+class BlendFilter : public Filter {
+private:
+    inline static const size_t ROWS_GRAIN = 64;
+    std::shared_ptr<const Image> second_;
+
+    static void BlendValue(long double& base, long double blend) {
+        base = TMode::Blend(base, blend);
+    }
+
+    static void BlendValue(Image::Pixel& base, long double blend) {
+        base = Image::Pixel(TMode::Blend(base.red, blend), TMode::Blend(base.green, blend),
+                            TMode::Blend(base.blue, blend));
+    }
+
+    static void BlendValue(Image::Pixel& base, const Image::Pixel& blend) {
+        base = Image::Pixel(TMode::Blend(base.red, blend.red), TMode::Blend(base.green, blend.green),
+                            TMode::Blend(base.blue, blend.blue));
+    }
+
+    // V and W are the value types of the image and of the second one
+    template <typename V, typename W>
+    void Apply(Image& image, size_t offset_x, size_t offset_y, size_t height, size_t width) const {
+        const Image& second = *second_;
+        ParallelFor(0, height, ROWS_GRAIN, [&, offset_x, offset_y](size_t begin, size_t end) {
+            for (size_t x = begin; x < end; ++x) {
+                std::span<V> base = image.Row<V>(x).first(width);
+                std::span<const W> blend = second.Row<W>(offset_x + x).subspan(offset_y, width);
+                for (size_t y = 0; y < width; ++y) {
+                    BlendValue(base[y], blend[y]);
+                }
+            }
+        });
+    }
+
+public:
+    explicit BlendFilter(std::shared_ptr<const Image> second) : second_(std::move(second)){};
+    size_t GetFootprint(size_t height, size_t width) const override {
+        return 0;
+    }
+    // GRAY images are expanded to RGB unless the second image is GRAY too
+    Image::Format GetFormat(Image::Format format) const override {
+        return second_->IsGray() ? format : Image::Format::RGB;
+    }
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override {
+        return GetFormat(format) == format ? 0 : Image::GetBytes(height, width, Image::Format::RGB);
+    }
+    long double GetCost(size_t height, size_t width, Image::Format format) const override {
+        return PerPixel(height, width, format, 40, 20) / GetThreadCount();
+    }
+    // the second image is named by its hash
+    std::string GetKey() const override {
+        return GetName() + "(" + std::to_string(second_->Hash()) + ")";
+    }
+    void operator()(Image& image) const override {
+        // both images are placed in frame coordinates, so windows of a frame line up with the second image
+        auto [origin_x, origin_y] = image.GetOrigin();
+        auto [second_x, second_y] = second_->GetOrigin();
+        size_t offset_x = origin_x - std::min(origin_x, second_x);
+        size_t offset_y = origin_y - std::min(origin_y, second_y);
+        size_t height = std::min(image.GetHeight(), second_->GetHeight() - std::min(offset_x, second_->GetHeight()));
+        size_t width = std::min(image.GetWidth(), second_->GetWidth() - std::min(offset_y, second_->GetWidth()));
+        if (image.IsGray() && second_->IsGray()) {
+            Apply<long double, long double>(image, offset_x, offset_y, height, width);
+            return;
+        }
+        image.ToRGB();
+        if (second_->IsGray()) {
+            Apply<Image::Pixel, long double>(image, offset_x, offset_y, height, width);
+        } else {
+            Apply<Image::Pixel, Image::Pixel>(image, offset_x, offset_y, height, width);
+        }
+    }
 };
 
-class ColorDodgeFilter : public ByPixelFilter {
+// the blend kernels below are branch-free: both sides of every condition are computed and one is selected
+
+class ColorDodgeFilter : public BlendFilter<ColorDodgeFilter> {
 private:
     inline static const std::string NAME = "ColorDodgeFilter";
-    std::shared_ptr<Image> second_;
-    void ComputePixel(Image& image, size_t x, size_t y) override;
 
 public:
     const std::string& GetName() const override {
         return NAME;
     }
-    explicit ColorDodgeFilter(std::shared_ptr<Image> second) : second_(second){};
+    using BlendFilter<ColorDodgeFilter>::BlendFilter;
+    static long double Blend(long double base, long double blend) {
+        long double quotient = base / (1 - blend);
+        return (blend >= 1) ? 1 : std::min<long double>(quotient, 1);
+    }
 };
 
-class ColorBurnFilter : public ByPixelFilter {
+class ColorBurnFilter : public BlendFilter<ColorBurnFilter> {
 private:
     inline static const std::string NAME = "ColorBurnFilter";
-    std::shared_ptr<Image> second_;
-    void ComputePixel(Image& image, size_t x, size_t y) override;
 
 public:
     const std::string& GetName() const override {
         return NAME;
     }
-    explicit ColorBurnFilter(std::shared_ptr<Image> second) : second_(second){};
+    using BlendFilter<ColorBurnFilter>::BlendFilter;
+    static long double Blend(long double base, long double blend) {
+        long double quotient = (1 - base) / blend;
+        return (blend <= 0) ? 0 : 1 - std::min<long double>(quotient, 1);
+    }
+};
+
+class MultiplyFilter : public BlendFilter<MultiplyFilter> {
+private:
+    inline static const std::string NAME = "MultiplyFilter";
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    using BlendFilter<MultiplyFilter>::BlendFilter;
+    static long double Blend(long double base, long double blend) {
+        return base * blend;
+    }
+};
+
+class ScreenFilter : public BlendFilter<ScreenFilter> {
+private:
+    inline static const std::string NAME = "ScreenFilter";
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    using BlendFilter<ScreenFilter>::BlendFilter;
+    static long double Blend(long double base, long double blend) {
+        return 1 - (1 - base) * (1 - blend);
+    }
+};
+
+class OverlayFilter : public BlendFilter<OverlayFilter> {
+private:
+    inline static const std::string NAME = "OverlayFilter";
+
+public:
+    const std::string& GetName() const override {
+        return NAME;
+    }
+    using BlendFilter<OverlayFilter>::BlendFilter;
+    static long double Blend(long double base, long double blend) {
+        long double dark = 2 * base * blend;
+        long double light = 1 - 2 * (1 - base) * (1 - blend);
+        return (base < 0.5) ? dark : light;
+    }
 };
 
 class SketchFilter : public Filter {
 private:
     inline static const std::string NAME = "SketchFilter";
-    long double sigma_;
+    GaussianFilter blur_;
 
 public:
     const std::string& GetName() const override {
         return NAME;
     }
-    explicit SketchFilter(const long double& sigma) : sigma_(sigma){};
-    void operator()(Image& image) override;
+    explicit SketchFilter(const long double& sigma, long double max_error = 0) : blur_(sigma, max_error){};
+    size_t GetFootprint(size_t height, size_t width) const override;
+    Image::Format GetFormat(Image::Format format) const override {
+        return Image::Format::GRAY;
+    }
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override;
+    long double GetCost(size_t height, size_t width, Image::Format format) const override;
+    std::string GetKey() const override {
+        return NAME + "(" + blur_.GetKey() + ")";
+    }
+    void operator()(Image& image) const override;
 };
 
 class ChalkFilter : public Filter {
 private:
     inline static const std::string NAME = "ChalkFilter";
-    long double sigma_;
+    GaussianFilter blur_;
 
 public:
     const std::string& GetName() const override {
         return NAME;
     }
-    explicit ChalkFilter(const long double& sigma) : sigma_(sigma){};
-    void operator()(Image& image) override;
+    explicit ChalkFilter(const long double& sigma, long double max_error = 0) : blur_(sigma, max_error){};
+    size_t GetFootprint(size_t height, size_t width) const override;
+    Image::Format GetFormat(Image::Format format) const override {
+        return Image::Format::GRAY;
+    }
+    size_t GetWorkspace(size_t height, size_t width, Image::Format format) const override;
+    long double GetCost(size_t height, size_t width, Image::Format format) const override;
+    std::string GetKey() const override {
+        return NAME + "(" + blur_.GetKey() + ")";
+    }
+    void operator()(Image& image) const override;
 };
@@ -0,0 +1,77 @@
+#include "Hash.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace {
+const uint64_t PRIME_1 = 11400714785074694791ULL;
+const uint64_t PRIME_2 = 14029467366897019727ULL;
+const uint64_t PRIME_3 = 1609587929392839161ULL;
+const uint64_t PRIME_4 = 9650029242287828579ULL;
+const uint64_t PRIME_5 = 2870177450012600261ULL;
+const size_t STRIPE_SIZE = 32;
+
+template <typename INT>
+INT ReadLittleEndian(const unsigned char* data) {
+    unsigned char bytes[sizeof(INT)];
+    std::memcpy(bytes, data, sizeof(INT));
+    if constexpr (std::endian::native == std::endian::big) {
+        std::reverse(bytes, bytes + sizeof(INT));
+    }
+    INT value = 0;
+    std::memcpy(&value, bytes, sizeof(INT));
+    return value;
+}
+
+uint64_t Round(uint64_t accumulator, uint64_t input) {
+    accumulator += input * PRIME_2;
+    accumulator = std::rotl(accumulator, 31);
+    return accumulator * PRIME_1;
+}
+
+uint64_t Merge(uint64_t hash, uint64_t accumulator) {
+    hash ^= Round(0, accumulator);
+    return hash * PRIME_1 + PRIME_4;
+}
+}  // namespace
+
+uint64_t Hash64(const void* data, size_t size, uint64_t seed) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    const unsigned char* end = bytes + size;
+    uint64_t hash = 0;
+    if (size >= STRIPE_SIZE) {
+        uint64_t lanes[4] = {seed + PRIME_1 + PRIME_2, seed + PRIME_2, seed, seed - PRIME_1};
+        for (; end - bytes >= static_cast<ptrdiff_t>(STRIPE_SIZE); bytes += STRIPE_SIZE) {
+            for (size_t i = 0; i < 4; ++i) {
+                lanes[i] = Round(lanes[i], ReadLittleEndian<uint64_t>(bytes + 8 * i));
+            }
+        }
+        hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+        for (uint64_t lane : lanes) {
+            hash = Merge(hash, lane);
+        }
+    } else {
+        hash = seed + PRIME_5;
+    }
+    hash += size;
+    for (; end - bytes >= 8; bytes += 8) {
+        hash ^= Round(0, ReadLittleEndian<uint64_t>(bytes));
+        hash = std::rotl(hash, 27) * PRIME_1 + PRIME_4;
+    }
+    if (end - bytes >= 4) {
+        hash ^= ReadLittleEndian<uint32_t>(bytes) * PRIME_1;
+        hash = std::rotl(hash, 23) * PRIME_2 + PRIME_3;
+        bytes += 4;
+    }
+    for (; bytes < end; ++bytes) {
+        hash ^= *bytes * PRIME_5;
+        hash = std::rotl(hash, 11) * PRIME_1;
+    }
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64 of size bytes; a few gigabytes per second, far cheaper than decoding or filtering the same bytes
+uint64_t Hash64(const void* data, size_t size, uint64_t seed = 0);
@@ -1,4 +1,10 @@
 #include "Image.h"
+
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+
+#include "Hash.h"
 #include "ImageException.h"
 
 Image::Pixel::Pixel(unsigned char r, unsigned char g, unsigned char b)
@@ -13,12 +19,12 @@ Image::Pixel* Image::Pixel::operator+=(const Pixel& other) {
     return this;
 }
 
-Image::Image(const std::vector<std::vector<Pixel>>& grid) : grid_(grid) {
+Image::Image(std::vector<std::vector<Pixel>> grid) : grid_(std::move(grid)) {
     if (!grid_.empty()) {
-        if (grid[0].empty()) {
+        if (grid_[0].empty()) {
             throw InvalidConstructor();
         }
-        size_t size = grid[0].size();
+        size_t size = grid_[0].size();
         for (const auto& row : grid_) {
             if (row.size() != size) {
                 throw InvalidConstructor();
@@ -27,12 +33,30 @@ Image::Image(const std::vector<std::vector<Pixel>>& grid) : grid_(grid) {
     }
 }
 
-Image::Image(const std::vector<std::vector<Pixel>>& grid, int32_t hor_res, int32_t ver_res) : Image(grid) {
+Image::Image(std::vector<std::vector<Pixel>> grid, int32_t hor_res, int32_t ver_res) : Image(std::move(grid)) {
     hor_res_ = hor_res;
     ver_res_ = ver_res;
 }
 
+Image::Image(GrayGrid gray, int32_t hor_res, int32_t ver_res)
+    : gray_(std::move(gray)), format_(Format::GRAY), hor_res_(hor_res), ver_res_(ver_res) {
+    if (!gray_.empty()) {
+        if (gray_[0].empty()) {
+            throw InvalidConstructor();
+        }
+        size_t size = gray_[0].size();
+        for (const auto& row : gray_) {
+            if (row.size() != size) {
+                throw InvalidConstructor();
+            }
+        }
+    }
+}
+
 Image::Pixel& Image::At(size_t x, size_t y) {
+    if (format_ != Format::RGB) {
+        throw WrongPixelFormat();
+    }
     if (x < grid_.size() && y < grid_[x].size()) {
         return grid_[x][y];
     } else {
@@ -41,6 +65,9 @@ Image::Pixel& Image::At(size_t x, size_t y) {
 }
 
 const Image::Pixel& Image::At(size_t x, size_t y) const {
+    if (format_ != Format::RGB) {
+        throw WrongPixelFormat();
+    }
     if (x < grid_.size() && y < grid_[x].size()) {
         return grid_[x][y];
     } else {
@@ -48,11 +75,164 @@ const Image::Pixel& Image::At(size_t x, size_t y) const {
     }
 }
 
+long double& Image::GrayAt(size_t x, size_t y) {
+    if (format_ != Format::GRAY) {
+        throw WrongPixelFormat();
+    }
+    if (x < gray_.size() && y < gray_[x].size()) {
+        return gray_[x][y];
+    } else {
+        throw OutOfBounds(x, y, GetHeight(), GetWidth());
+    }
+}
+
+const long double& Image::GrayAt(size_t x, size_t y) const {
+    if (format_ != Format::GRAY) {
+        throw WrongPixelFormat();
+    }
+    if (x < gray_.size() && y < gray_[x].size()) {
+        return gray_[x][y];
+    } else {
+        throw OutOfBounds(x, y, GetHeight(), GetWidth());
+    }
+}
+
+Image::Pixel Image::Get(size_t x, size_t y) const {
+    if (format_ == Format::GRAY) {
+        long double value = GrayAt(x, y);
+        return Pixel(value, value, value);
+    }
+    return At(x, y);
+}
+
+std::span<Image::Pixel> Image::PixelRow(size_t x) {
+    ToRGB();
+    if (x < grid_.size()) {
+        return grid_[x];
+    } else {
+        throw OutOfBounds(x, 0, GetHeight(), GetWidth());
+    }
+}
+
+std::span<const Image::Pixel> Image::PixelRow(size_t x) const {
+    if (format_ != Format::RGB) {
+        throw WrongPixelFormat();
+    }
+    if (x < grid_.size()) {
+        return grid_[x];
+    } else {
+        throw OutOfBounds(x, 0, GetHeight(), GetWidth());
+    }
+}
+
+std::span<long double> Image::GrayRow(size_t x) {
+    if (format_ != Format::GRAY) {
+        throw WrongPixelFormat();
+    }
+    if (x < gray_.size()) {
+        return gray_[x];
+    } else {
+        throw OutOfBounds(x, 0, GetHeight(), GetWidth());
+    }
+}
+
+std::span<const long double> Image::GrayRow(size_t x) const {
+    if (format_ != Format::GRAY) {
+        throw WrongPixelFormat();
+    }
+    if (x < gray_.size()) {
+        return gray_[x];
+    } else {
+        throw OutOfBounds(x, 0, GetHeight(), GetWidth());
+    }
+}
+
+Image::Format Image::GetFormat() const {
+    return format_;
+}
+
+bool Image::IsGray() const {
+    return format_ == Format::GRAY;
+}
+
+void Image::ToRGB() {
+    if (format_ == Format::RGB) {
+        return;
+    }
+    grid_.resize(gray_.size());
+    for (size_t i = 0; i < gray_.size(); ++i) {
+        grid_[i].reserve(gray_[i].size());
+        for (long double value : gray_[i]) {
+            grid_[i].emplace_back(value, value, value);
+        }
+        std::vector<long double>().swap(gray_[i]);
+    }
+    GrayGrid().swap(gray_);
+    format_ = Format::RGB;
+}
+
+void Image::SetGray(GrayGrid gray) {
+    Image replacement(std::move(gray), hor_res_, ver_res_);
+    if (replacement.GetHeight() != GetHeight() || replacement.GetWidth() != GetWidth()) {
+        throw InvalidConstructor();
+    }
+    gray_ = std::move(replacement.gray_);
+    std::vector<std::vector<Pixel>>().swap(grid_);
+    format_ = Format::GRAY;
+}
+
+bool Image::HasAlpha() const {
+    return !alpha_.empty();
+}
+
+long double& Image::AlphaAt(size_t x, size_t y) {
+    if (x < alpha_.size() && y < alpha_[x].size()) {
+        return alpha_[x][y];
+    } else {
+        throw OutOfBounds(x, y, GetHeight(), GetWidth());
+    }
+}
+
+const long double& Image::AlphaAt(size_t x, size_t y) const {
+    if (x < alpha_.size() && y < alpha_[x].size()) {
+        return alpha_[x][y];
+    } else {
+        throw OutOfBounds(x, y, GetHeight(), GetWidth());
+    }
+}
+
+void Image::SetAlpha(GrayGrid alpha) {
+    if (!alpha.empty() && (alpha.size() != GetHeight() || alpha[0].size() != GetWidth())) {
+        throw InvalidConstructor();
+    }
+    alpha_ = std::move(alpha);
+}
+
+Image::GrayGrid Image::ReleaseAlpha() {
+    GrayGrid alpha;
+    alpha.swap(alpha_);
+    return alpha;
+}
+
+const Image::ChannelMasks& Image::GetMasks() const {
+    return masks_;
+}
+
+void Image::SetMasks(const ChannelMasks& masks) {
+    masks_ = masks;
+}
+
 size_t Image::GetHeight() const {
+    if (format_ == Format::GRAY) {
+        return gray_.size();
+    }
     return grid_.size();
 }
 
 size_t Image::GetWidth() const {
+    if (format_ == Format::GRAY) {
+        return gray_.empty() ? 0 : gray_[0].size();
+    }
     if (!grid_.empty()) {
         return grid_[0].size();
     } else {
@@ -65,8 +245,171 @@ std::pair<int32_t, int32_t> Image::GetRes() const {
 }
 
 void Image::Resize(size_t new_height, size_t new_width) {
+    if (!alpha_.empty()) {
+        alpha_.resize(new_height);
+        for (auto& row : alpha_) {
+            row.resize(new_width);
+        }
+    }
+    if (format_ == Format::GRAY) {
+        gray_.resize(new_height);
+        for (auto& row : gray_) {
+            row.resize(new_width);
+        }
+        return;
+    }
     grid_.resize(new_height);
     for (auto& row : grid_) {
         row.resize(new_width);
     }
 }
+
+void Image::FlipRows() {
+    std::reverse(alpha_.begin(), alpha_.end());
+    std::reverse(gray_.begin(), gray_.end());
+    std::reverse(grid_.begin(), grid_.end());
+}
+
+std::pair<size_t, size_t> Image::GetOrigin() const {
+    return {origin_x_, origin_y_};
+}
+
+std::pair<size_t, size_t> Image::GetFrameSize() const {
+    if (frame_height_ == 0 && frame_width_ == 0) {
+        return {GetHeight(), GetWidth()};
+    }
+    return {frame_height_, frame_width_};
+}
+
+Image Image::Window(size_t x, size_t y, size_t height, size_t width) const {
+    if (x + height > GetHeight() || y + width > GetWidth()) {
+        throw OutOfBounds(x + height - 1, y + width - 1, GetHeight(), GetWidth());
+    }
+    Image window;
+    window.format_ = format_;
+    if (format_ == Format::GRAY) {
+        window.gray_.reserve(height);
+        for (size_t i = x; i < x + height; ++i) {
+            window.gray_.emplace_back(gray_[i].begin() + y, gray_[i].begin() + y + width);
+        }
+    } else {
+        window.grid_.reserve(height);
+        for (size_t i = x; i < x + height; ++i) {
+            window.grid_.emplace_back(grid_[i].begin() + y, grid_[i].begin() + y + width);
+        }
+    }
+    window.hor_res_ = hor_res_;
+    window.ver_res_ = ver_res_;
+    window.masks_ = masks_;
+    window.origin_x_ = origin_x_ + x;
+    window.origin_y_ = origin_y_ + y;
+    std::tie(window.frame_height_, window.frame_width_) = GetFrameSize();
+    return window;
+}
+
+void Image::SetFrame(size_t x, size_t y, size_t frame_height, size_t frame_width) {
+    origin_x_ = x;
+    origin_y_ = y;
+    frame_height_ = frame_height;
+    frame_width_ = frame_width;
+}
+
+Image Image::SplitRows(size_t x) {
+    if (x > GetHeight()) {
+        throw OutOfBounds(x, 0, GetHeight(), GetWidth());
+    }
+    std::tie(frame_height_, frame_width_) = GetFrameSize();
+    Image rows;
+    rows.format_ = format_;
+    rows.masks_ = masks_;
+    rows.hor_res_ = hor_res_;
+    rows.ver_res_ = ver_res_;
+    rows.SetFrame(origin_x_ + x, origin_y_, frame_height_, frame_width_);
+    auto split = [x](auto& from, auto& to) {
+        if (x < from.size()) {
+            to.assign(std::make_move_iterator(from.begin() + static_cast<ptrdiff_t>(x)),
+                      std::make_move_iterator(from.end()));
+            from.resize(x);
+        }
+    };
+    split(grid_, rows.grid_);
+    split(gray_, rows.gray_);
+    split(alpha_, rows.alpha_);
+    return rows;
+}
+
+void Image::AppendRows(Image rows) {
+    // an empty image takes the rows as they are, with their place in the frame
+    if (GetHeight() == 0 && alpha_.empty()) {
+        *this = std::move(rows);
+        return;
+    }
+    if (rows.GetHeight() == 0) {
+        return;
+    }
+    if (rows.format_ != format_) {
+        throw WrongPixelFormat();
+    }
+    if (rows.GetWidth() != GetWidth() || rows.alpha_.empty() != alpha_.empty()) {
+        throw InvalidConstructor();
+    }
+    auto append = [](auto& to, auto& from) {
+        to.insert(to.end(), std::make_move_iterator(from.begin()), std::make_move_iterator(from.end()));
+    };
+    append(grid_, rows.grid_);
+    append(gray_, rows.gray_);
+    append(alpha_, rows.alpha_);
+}
+
+void Image::Paste(const Image& source, size_t source_x, size_t source_y, size_t x, size_t y, size_t height,
+                  size_t width) {
+    if (source.format_ != format_) {
+        throw WrongPixelFormat();
+    }
+    if (source_x + height > source.GetHeight() || source_y + width > source.GetWidth()) {
+        throw OutOfBounds(source_x + height - 1, source_y + width - 1, source.GetHeight(), source.GetWidth());
+    }
+    if (x + height > GetHeight() || y + width > GetWidth()) {
+        throw OutOfBounds(x + height - 1, y + width - 1, GetHeight(), GetWidth());
+    }
+    for (size_t i = 0; i < height; ++i) {
+        if (format_ == Format::GRAY) {
+            std::copy_n(source.gray_[source_x + i].begin() + source_y, width, gray_[x + i].begin() + y);
+        } else {
+            std::copy_n(source.grid_[source_x + i].begin() + source_y, width, grid_[x + i].begin() + y);
+        }
+    }
+}
+
+uint64_t Image::Hash() const {
+    uint64_t shape[] = {GetHeight(), GetWidth(), origin_x_, origin_y_, alpha_.size()};
+    uint64_t hash = Hash64(shape, sizeof(shape), Hash(0, 0, GetHeight(), GetWidth()));
+    std::vector<double> row;
+    for (const std::vector<long double>& alpha_row : alpha_) {
+        row.assign(alpha_row.begin(), alpha_row.end());
+        hash = Hash64(row.data(), row.size() * sizeof(double), hash);
+    }
+    return hash;
+}
+
+uint64_t Image::Hash(size_t x, size_t y, size_t height, size_t width) const {
+    if (x + height > GetHeight() || y + width > GetWidth()) {
+        throw OutOfBounds(x + height - 1, y + width - 1, GetHeight(), GetWidth());
+    }
+    uint64_t hash = static_cast<uint64_t>(format_);
+    std::vector<double> row;
+    for (size_t i = x; i < x + height; ++i) {
+        row.clear();
+        if (format_ == Format::GRAY) {
+            row.assign(gray_[i].begin() + y, gray_[i].begin() + y + width);
+        } else {
+            for (size_t j = y; j < y + width; ++j) {
+                const Pixel& pixel = grid_[i][j];
+                row.insert(row.end(), {static_cast<double>(pixel.red), static_cast<double>(pixel.green),
+                                       static_cast<double>(pixel.blue)});
+            }
+        }
+        hash = Hash64(row.data(), row.size() * sizeof(double), hash);
+    }
+    return hash;
+}
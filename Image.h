@@ -2,10 +2,15 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <span>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 class Image {
 public:
+    enum class Format { RGB, GRAY };
+
     struct Pixel {
         inline static const long double DEPTH = 255;
         long double red, green, blue;
@@ -23,20 +28,137 @@ public:
         }
     };
 
+    using GrayGrid = std::vector<std::vector<long double>>;
+
+    // positions of the channels in a 32-bit pixel, kept to write the image back the way it was read
+    struct ChannelMasks {
+        uint32_t red = 0x00FF0000;
+        uint32_t green = 0x0000FF00;
+        uint32_t blue = 0x000000FF;
+        uint32_t alpha = 0xFF000000;
+    };
+
 private:
     std::vector<std::vector<Pixel>> grid_;
+    // luminance plane, used instead of grid_ while the image is in GRAY format
+    GrayGrid gray_;
+    Format format_ = Format::RGB;
+    // opacity plane, empty for opaque images; filters leave it untouched
+    GrayGrid alpha_;
+    ChannelMasks masks_;
+    // set for windows cut out of a larger frame, so that filters work in frame coordinates
+    size_t origin_x_ = 0;
+    size_t origin_y_ = 0;
+    size_t frame_height_ = 0;
+    size_t frame_width_ = 0;
     int32_t hor_res_ = 1;
     int32_t ver_res_ = 1;
 
 public:
     Image() = default;
-    explicit Image(const std::vector<std::vector<Pixel>>& grid);
-    Image(const std::vector<std::vector<Pixel>>& grid, int32_t hor_res, int32_t ver_res);
+    explicit Image(std::vector<std::vector<Pixel>> grid);
+    Image(std::vector<std::vector<Pixel>> grid, int32_t hor_res, int32_t ver_res);
+
+    Image(GrayGrid gray, int32_t hor_res, int32_t ver_res);
 
+    // the image must be in RGB format
     Pixel& At(size_t x, size_t y);
 
+    // the image must be in RGB format
     const Pixel& At(size_t x, size_t y) const;
 
+    // the image must be in GRAY format
+    long double& GrayAt(size_t x, size_t y);
+
+    const long double& GrayAt(size_t x, size_t y) const;
+
+    // works with both formats
+    Pixel Get(size_t x, size_t y) const;
+
+    // whole rows for line kernels, with the same format requirements as At and GrayAt
+    std::span<Pixel> PixelRow(size_t x);
+
+    std::span<const Pixel> PixelRow(size_t x) const;
+
+    std::span<long double> GrayRow(size_t x);
+
+    std::span<const long double> GrayRow(size_t x) const;
+
+    template <typename V>
+    std::span<V> Row(size_t x) {
+        if constexpr (std::is_same_v<V, Pixel>) {
+            return PixelRow(x);
+        } else {
+            return GrayRow(x);
+        }
+    }
+
+    template <typename V>
+    std::span<const V> Row(size_t x) const {
+        if constexpr (std::is_same_v<V, Pixel>) {
+            return PixelRow(x);
+        } else {
+            return GrayRow(x);
+        }
+    }
+
+    template <typename V>
+    V& Value(size_t x, size_t y) {
+        if constexpr (std::is_same_v<V, Pixel>) {
+            return At(x, y);
+        } else {
+            return GrayAt(x, y);
+        }
+    }
+
+    Format GetFormat() const;
+
+    // bytes the values of an image of the given size and format take, without its alpha plane
+    static size_t GetBytes(size_t height, size_t width, Format format) {
+        return height * width * (format == Format::GRAY ? sizeof(long double) : sizeof(Pixel));
+    }
+
+    bool IsGray() const;
+
+    // converts the image to GRAY format, computing the luminance of every pixel with luma(pixel)
+    template <typename F>
+    void ToGray(F luma) {
+        if (format_ == Format::GRAY) {
+            return;
+        }
+        gray_.resize(grid_.size());
+        for (size_t i = 0; i < grid_.size(); ++i) {
+            gray_[i].resize(grid_[i].size());
+            for (size_t j = 0; j < grid_[i].size(); ++j) {
+                gray_[i][j] = luma(grid_[i][j]);
+            }
+            std::vector<Pixel>().swap(grid_[i]);
+        }
+        std::vector<std::vector<Pixel>>().swap(grid_);
+        format_ = Format::GRAY;
+    }
+
+    void ToRGB();
+
+    // replaces the pixels with a luminance plane of the same size, leaving the image in GRAY format
+    void SetGray(GrayGrid gray);
+
+    bool HasAlpha() const;
+
+    long double& AlphaAt(size_t x, size_t y);
+
+    const long double& AlphaAt(size_t x, size_t y) const;
+
+    // an empty plane makes the image opaque
+    void SetAlpha(GrayGrid alpha);
+
+    // moves the opacity plane out, leaving the image opaque
+    GrayGrid ReleaseAlpha();
+
+    const ChannelMasks& GetMasks() const;
+
+    void SetMasks(const ChannelMasks& masks);
+
     size_t GetHeight() const;
 
     size_t GetWidth() const;
@@ -44,4 +166,37 @@ public:
     std::pair<int32_t, int32_t> GetRes() const;
 
     void Resize(size_t new_height, size_t new_width);
+
+    // reverses the order of the rows, with the alpha plane; the rows are moved as a whole, without copying pixels
+    void FlipRows();
+
+    // position of the image in the frame it was cut from with Window(), (0, 0) for a whole frame
+    std::pair<size_t, size_t> GetOrigin() const;
+
+    // height and width of that frame
+    std::pair<size_t, size_t> GetFrameSize() const;
+
+    // copies a part of the image without its alpha plane, keeping track of where it lies in the frame
+    Image Window(size_t x, size_t y, size_t height, size_t width) const;
+
+    // places the image at (x, y) in a frame of the given size, like the windows Window() cuts out
+    void SetFrame(size_t x, size_t y, size_t frame_height, size_t frame_width);
+
+    // moves rows [x, height) with their alpha out into an image lying below this one in the frame, without copying
+    // pixels
+    Image SplitRows(size_t x);
+
+    // moves the rows of an image of the same format, width and alpha below the last one, without copying pixels
+    void AppendRows(Image rows);
+
+    // copies a part of source, which must have the same format, to (x, y)
+    void Paste(const Image& source, size_t source_x, size_t source_y, size_t x, size_t y, size_t height,
+               size_t width);
+
+    // hash of the size, format, position in the frame, pixels and alpha plane; values are hashed at double
+    // precision, which tells apart all values read from files
+    uint64_t Hash() const;
+
+    // hash of the format and the pixels of a part of the image, without its alpha plane
+    uint64_t Hash(size_t x, size_t y, size_t height, size_t width) const;
 };
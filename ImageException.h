@@ -34,6 +34,14 @@ public:
     InvalidConstructor() : ImageException(MESSAGE){};
 };
 
+class WrongPixelFormat : public ImageException {
+private:
+    inline static const std::string MESSAGE = "Trying to access the pixels of an image in a different format";
+
+public:
+    WrongPixelFormat() : ImageException(MESSAGE){};
+};
+
 class FileException : public ImageException {
 private:
     inline static const std::string NAME = "File";
@@ -92,6 +100,15 @@ public:
     explicit DamagedFile(const char* filename) : FileException(MESSAGE, filename){};
 };
 
+class SocketError : public FileException {
+private:
+    inline static const std::string MESSAGE = "Cannot use socket";
+
+public:
+    SocketError() : FileException(MESSAGE){};
+    explicit SocketError(const char* filename) : FileException(MESSAGE, filename){};
+};
+
 class FilterException : public ImageException {
 private:
     inline static const std::string NAME = "Filter";
@@ -140,6 +157,15 @@ public:
     NoOutput() : InputException(MESSAGE){};
 };
 
+class MemoryLimitExceeded : public InputException {
+private:
+    inline static const std::string MESSAGE =
+        "No way of running the filters stays within -max-memory (the least needs ";
+
+public:
+    explicit MemoryLimitExceeded(size_t bytes) : InputException(MESSAGE + std::to_string(bytes) + " bytes)"){};
+};
+
 class OptionException : public InputException {
 private:
     inline static const std::string NAME = "Option";
@@ -167,6 +193,14 @@ public:
     explicit UnknownOption(const char* option) : OptionException(MESSAGE, option){};
 };
 
+class UnsupportedOption : public OptionException {
+private:
+    inline static const std::string MESSAGE = "Not supported by --serve";
+
+public:
+    explicit UnsupportedOption(const char* option) : OptionException(MESSAGE, option){};
+};
+
 class TooManyArguments : public OptionException {
 private:
     inline static const std::string MESSAGE = "Too many arguments given (expected ";
@@ -1,11 +1,60 @@
 #include "ImageRedactor.h"
 
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
 #include <string>
 #include <string_view>
 #include <memory>
+#include <tuple>
 
-#include "ImageException.h"
 #include "BMPio.h"
+#include "ImageException.h"
+#include "ImageStatistics.h"
+#include "IncrementalState.h"
+#include "Parallel.h"
+#include "Profiler.h"
+#include "TiledExecutor.h"
+#include "Tuning.h"
+
+namespace {
+std::vector<unsigned char> ReadFile(const char* filename) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw OpenFileError(filename);
+    }
+    std::vector<unsigned char> data(file.tellg());
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()))) {
+        throw ReadFileError(filename);
+    }
+    return data;
+}
+
+// the bytes with the mebibytes they make
+std::string FormatBytes(size_t bytes) {
+    std::ostringstream text;
+    text << bytes << " bytes (" << std::fixed << std::setprecision(1) << static_cast<long double>(bytes) / (1 << 20)
+         << " MiB)";
+    return text.str();
+}
+
+void WriteStatisticsFile(const std::string& filename, const Image& image, uint16_t bits_per_pixel) {
+    std::ofstream file(filename, std::ios::trunc);
+    if (!file.is_open()) {
+        throw OpenFileError(filename.c_str());
+    }
+    if (!(file << ImageStatistics(image, bits_per_pixel).ToJSON())) {
+        throw WriteFileError(filename.c_str());
+    }
+}
+}  // namespace
 
 void Interpret(size_t& dest, char** argv, size_t& i, size_t option, size_t expected_args) {
     ++i;
@@ -50,20 +99,38 @@ void Interpret(long double& dest, char** argv, size_t& i, size_t option, size_t
     }
 }
 
-void ImageRedactor::ApplyFilter(Filter& filter) {
-    try {
-        filter(image_);
-    } catch (FilterException& e) {
-        e.SetFilter(filter.GetName());
-        throw e;
-    } catch (const std::exception& e) {
-        throw BrokenFilter(filter.GetName());
+void ImageRedactor::ApplyFilter(const Filter& filter) {
+    RunFilter(filter, image_);
+}
+
+void ImageRedactor::Parse(size_t argc, char** argv) {
+    chains_.clear();
+    ParseChain(argc, argv, chains_.emplace_back());
+}
+
+void ImageRedactor::ParseVariants(size_t argc, char** argv) {
+    chains_.clear();
+    size_t begin = 0;
+    while (begin <= argc) {
+        size_t end = begin;
+        while (end < argc && std::string_view(argv[end]) != "--") {
+            ++end;
+        }
+        if (end == begin) {
+            throw NoOutput();
+        }
+        Chain& chain = chains_.emplace_back();
+        chain.output = argv[begin];
+        ParseChain(end - begin - 1, argv + begin + 1, chain);
+        begin = end + 1;
     }
 }
 
-void ImageRedactor::Execute(size_t argc, char** argv) {
-    std::vector<std::unique_ptr<Filter>> filters;
+void ImageRedactor::ParseChain(size_t argc, char** argv, Chain& chain) {
     size_t option = 0;
+    // -blur-error applies to all the blurs of the chain, wherever it is given
+    long double max_error = 0;
+    std::string max_error_text;
     for (size_t i = 0; i < argc; ++i) {
         std::string_view view(argv[i]);
         size_t last = option;
@@ -76,57 +143,204 @@ void ImageRedactor::Execute(size_t argc, char** argv) {
             size_t height = 0;
             Interpret(width, argv, i, option, 2);
             Interpret(height, argv, i, option, 2);
-            filters.emplace_back(std::make_unique<CropFilter>(width, height));
+            chain.filters.push_back(FilterSpec::Crop(width, height));
         } else if (view == "-gs") {
-            filters.emplace_back(std::make_unique<GrayscaleFilter>());
+            chain.filters.push_back(FilterSpec::Grayscale());
         } else if (view == "-neg") {
-            filters.emplace_back(std::make_unique<NegativeFilter>());
+            chain.filters.push_back(FilterSpec::Negative());
         } else if (view == "-sharp") {
-            filters.emplace_back(std::make_unique<SharpeningFilter>());
+            chain.filters.push_back(FilterSpec::Sharpening());
         } else if (view == "-edge") {
             if (i + 1 >= argc) {
                 throw TooFewArguments(view.data(), 1);
             }
-            long double threshold = 0;
-            Interpret(threshold, argv, i, option, 1);
-            filters.emplace_back(std::make_unique<EdgeDetectionFilter>(threshold));
+            if (std::string_view(argv[i + 1]) == "auto") {
+                ++i;
+                chain.filters.push_back(FilterSpec::AutomaticEdgeDetection());
+            } else {
+                long double threshold = 0;
+                Interpret(threshold, argv, i, option, 1);
+                chain.filters.push_back(FilterSpec::EdgeDetection(threshold));
+            }
+        } else if (view == "-threshold") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            if (std::string_view(argv[i + 1]) == "auto") {
+                ++i;
+                chain.filters.push_back(FilterSpec::AutomaticThreshold());
+            } else {
+                long double threshold = 0;
+                Interpret(threshold, argv, i, option, 1);
+                chain.filters.push_back(FilterSpec::Threshold(threshold));
+            }
         } else if (view == "-blur") {
             if (i + 1 >= argc) {
                 throw TooFewArguments(view.data(), 1);
             }
             long double sigma = 0;
             Interpret(sigma, argv, i, option, 1);
-            filters.emplace_back(std::make_unique<GaussianFilter>(sigma));
+            chain.filters.push_back(FilterSpec::GaussianBlur(sigma));
         } else if (view == "-burn") {
             if (i + 1 >= argc) {
                 throw TooFewArguments(view.data(), 1);
             }
             ++i;
-            std::shared_ptr<Image> second(std::make_unique<Image>());
-            ReadBMP(argv[i], *second);
-            filters.emplace_back(std::make_unique<ColorBurnFilter>(second));
+            chain.filters.push_back(FilterSpec::ColorBurn(auxiliary_.Get(argv[i])));
         } else if (view == "-dodge") {
             if (i + 1 >= argc) {
                 throw TooFewArguments(view.data(), 1);
             }
             ++i;
-            std::shared_ptr<Image> second(std::make_unique<Image>());
-            ReadBMP(argv[i], *second);
-            filters.emplace_back(std::make_unique<ColorDodgeFilter>(second));
+            chain.filters.push_back(FilterSpec::ColorDodge(auxiliary_.Get(argv[i])));
+        } else if (view == "-multiply") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            ++i;
+            chain.filters.push_back(FilterSpec::Multiply(auxiliary_.Get(argv[i])));
+        } else if (view == "-screen") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            ++i;
+            chain.filters.push_back(FilterSpec::Screen(auxiliary_.Get(argv[i])));
+        } else if (view == "-overlay") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            ++i;
+            chain.filters.push_back(FilterSpec::Overlay(auxiliary_.Get(argv[i])));
         } else if (view == "-chalk") {
             if (i + 1 >= argc) {
                 throw TooFewArguments(view.data(), 1);
             }
             long double sigma = 0;
             Interpret(sigma, argv, i, option, 1);
-            filters.emplace_back(std::make_unique<ChalkFilter>(sigma));
+            chain.filters.push_back(FilterSpec::Chalk(sigma));
         } else if (view == "-sketch") {
             if (i + 1 >= argc) {
                 throw TooFewArguments(view.data(), 1);
             }
             long double sigma = 0;
             Interpret(sigma, argv, i, option, 1);
-            filters.emplace_back(std::make_unique<SketchFilter>(sigma));
+            chain.filters.push_back(FilterSpec::Sketch(sigma));
+        } else if (view == "-scale") {
+            if (i + 2 >= argc) {
+                throw TooFewArguments(view.data(), 2);
+            }
+            size_t width = 0;
+            size_t height = 0;
+            Interpret(width, argv, i, option, 2);
+            Interpret(height, argv, i, option, 2);
+            chain.filters.push_back(FilterSpec::Scale(width, height));
+        } else if (view == "-thumb") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            size_t size = 0;
+            Interpret(size, argv, i, option, 1);
+            chain.filters.push_back(FilterSpec::Thumbnail(size));
+        } else if (view == "-rotate") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            size_t degrees = 0;
+            Interpret(degrees, argv, i, option, 1);
+            chain.filters.push_back(FilterSpec::Rotate(degrees));
+        } else if (view == "-flipv") {
+            chain.filters.push_back(FilterSpec::FlipVertical());
+        } else if (view == "-fliph") {
+            chain.filters.push_back(FilterSpec::FlipHorizontal());
+        } else if (view == "-box") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            size_t radius = 0;
+            Interpret(radius, argv, i, option, 1);
+            chain.filters.push_back(FilterSpec::BoxBlur(radius));
+        } else if (view == "-median") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            size_t radius = 0;
+            Interpret(radius, argv, i, option, 1);
+            chain.filters.push_back(FilterSpec::Median(radius));
+        } else if (view == "-athresh") {
+            if (i + 2 >= argc) {
+                throw TooFewArguments(view.data(), 2);
+            }
+            size_t radius = 0;
+            long double offset = 0;
+            Interpret(radius, argv, i, option, 2);
+            Interpret(offset, argv, i, option, 2);
+            chain.filters.push_back(FilterSpec::AdaptiveThreshold(radius, offset));
+        } else if (view == "-blur-error") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            long double levels = 0;
+            Interpret(levels, argv, i, option, 1);
+            if (levels < 0) {
+                throw ProhibitedValue(argv[i], "<levels>");
+            }
+            max_error = levels / Image::Pixel::DEPTH;
+            max_error_text = argv[i];
+        } else if (view == "-bpp") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            size_t bits = 0;
+            Interpret(bits, argv, i, option, 1);
+            if (bits != 1 && bits != 8 && bits != 24 && bits != 32) {
+                throw ProhibitedValue(std::to_string(bits), "<bits>");
+            }
+            chain.bits_per_pixel = static_cast<uint16_t>(bits);
+        } else if (view == "-stats") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            ++i;
+            chain.stats = argv[i];
+        } else if (view == "-cache") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            ++i;
+            cache_directory_ = argv[i];
+        } else if (view == "-cache-size") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            size_t megabytes = 0;
+            Interpret(megabytes, argv, i, option, 1);
+            cache_size_ = static_cast<uintmax_t>(megabytes) << 20;
+        } else if (view == "-perf") {
+            profile_ = true;
+        } else if (view == "-max-memory") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            Interpret(max_memory_, argv, i, option, 1);
+            if (max_memory_ == 0) {
+                throw ProhibitedValue("0", "<bytes>");
+            }
+        } else if (view == "-explain") {
+            explain_ = true;
+        } else if (view == "-deadline") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            Interpret(deadline_, argv, i, option, 1);
+            if (deadline_ <= 0) {
+                throw ProhibitedValue(argv[i], "<milliseconds>");
+            }
+        } else if (view == "-incremental") {
+            if (i + 1 >= argc) {
+                throw TooFewArguments(view.data(), 1);
+            }
+            ++i;
+            chain.state = argv[i];
         } else if (view == "-") {
             throw NoOptionName();
         } else if (!view.empty()) {
@@ -136,8 +350,539 @@ void ImageRedactor::Execute(size_t argc, char** argv) {
                 throw TooManyArguments(argv[last], i - last - 1);
             }
         }
+        if (chain.options.size() < chain.filters.size()) {
+            std::string text(argv[option]);
+            for (size_t arg = option + 1; arg <= i; ++arg) {
+                text.append(" ").append(argv[arg]);
+            }
+            chain.options.push_back(std::move(text));
+        }
     }
-    for (auto& filter : filters) {
-        ApplyFilter(*filter);
+    if (max_error == 0) {
+        return;
+    }
+    for (size_t i = 0; i < chain.filters.size(); ++i) {
+        FilterSpec& spec = chain.filters[i];
+        if (spec.kind == FilterSpec::Kind::GAUSSIAN_BLUR || spec.kind == FilterSpec::Kind::CHALK ||
+            spec.kind == FilterSpec::Kind::SKETCH) {
+            spec.max_error = max_error;
+            // chains share the blur only if they allow the same error
+            chain.options[i] += " -blur-error " + max_error_text;
+        }
+    }
+}
+
+void ImageRedactor::LoadAuxiliary() {
+    auxiliary_.Load();
+}
+
+void ImageRedactor::Execute() {
+    auxiliary_.Wait();
+    if (chains_.empty()) {
+        chains_.emplace_back();
+    }
+    Pipeline pipeline(chains_[0].filters, GetStripRows());
+    pipeline(image_);
+    if (chains_[0].bits_per_pixel != 0 && chains_[0].bits_per_pixel < 24 && !image_.IsGray()) {
+        GrayscaleFilter grayscale;
+        ApplyFilter(grayscale);
+    }
+}
+
+void ImageRedactor::Execute(size_t argc, char** argv) {
+    Parse(argc, argv);
+    Execute();
+}
+
+void ImageRedactor::ExecuteVariants(const Writer& write) {
+    auxiliary_.Wait();
+    std::vector<size_t> chains(chains_.size());
+    for (size_t i = 0; i < chains.size(); ++i) {
+        chains[i] = i;
+    }
+    ExecuteVariants(chains, 0, std::move(image_), write);
+    image_ = Image();
+}
+
+void ImageRedactor::ExecuteVariants(const char* input, const Writer& write) {
+    if (strategy_ == Strategy::STREAMING) {
+        ExecuteStreaming(input);
+        return;
+    }
+    std::vector<unsigned char> data;
+    std::optional<ResultCache> cache;
+    std::map<std::string, std::string> keys;
+    if (cache_directory_.empty()) {
+        Profiler::Stage stage("ReadBMP");
+        ReadBMP(input, image_);
+        stage.SetPixels(image_.GetHeight() * image_.GetWidth());
+    } else {
+        // hashing the file takes a fraction of the time decoding it does
+        data = ReadFile(input);
+        auxiliary_.Wait();
+        cache.emplace(cache_directory_, cache_size_);
+        std::vector<Chain> missed;
+        for (Chain& chain : chains_) {
+            std::string key = ResultCache::GetKey(data, GetKey(chain));
+            // the statistics of -stats need the image itself, which the cache does not keep
+            if (!chain.stats.empty() || !cache->Fetch(key, chain.output)) {
+                keys[chain.output] = key;
+                missed.push_back(std::move(chain));
+            }
+        }
+        chains_ = std::move(missed);
+        if (chains_.empty()) {
+            return;
+        }
+        {
+            Profiler::Stage stage("ReadBMP");
+            ReadBMP()(data.data(), data.size(), image_);
+            stage.SetPixels(image_.GetHeight() * image_.GetWidth());
+        }
+        data = std::vector<unsigned char>();
+    }
+    Writer store = [&](const Image& image, const std::string& output, uint16_t bits_per_pixel) {
+        std::string written;
+        {
+            Profiler::Stage stage("WriteBMP " + output, image.GetHeight() * image.GetWidth());
+            written = write(image, output, bits_per_pixel);
+        }
+        if (cache) {
+            cache->Store(keys[output], written);
+        }
+        return written;
+    };
+    auxiliary_.Wait();
+    auto incremental = std::stable_partition(chains_.begin(), chains_.end(),
+                                             [](const Chain& chain) { return chain.state.empty(); });
+    for (auto chain = incremental; chain != chains_.end(); ++chain) {
+        ExecuteIncremental(*chain, image_, store);
+    }
+    chains_.erase(incremental, chains_.end());
+    ExecuteVariants(store);
+}
+
+void ImageRedactor::ExecuteIncremental(const Chain& chain, Image image, const Writer& write) const {
+    Pipeline pipeline(chain.filters, GetStripRows());
+    TiledExecutor tiled;
+    IncrementalState state(chain.state, GetKey(chain), tiled.GetTileSize());
+    size_t footprint = pipeline.GetFootprint(image.GetHeight(), image.GetWidth());
+    std::vector<uint64_t> tiles;
+    std::optional<std::vector<size_t>> dirty;
+    if (footprint != Filter::FULL_FRAME) {
+        tiles = IncrementalState::HashTiles(image, tiled);
+        dirty = state.GetDirty(image, tiles, footprint, tiled);
+    }
+    bool gray = chain.bits_per_pixel != 0 && chain.bits_per_pixel < 24;
+    Image result;
+    if (dirty) {
+        result = state.LoadOutput();
+        // the last output was written in the format the tiles take once converted to the depth of the chain
+        pipeline(image, tiled, *dirty,
+                 [&](Image& window, size_t source_x, size_t source_y, size_t x, size_t y, size_t height,
+                     size_t width) {
+                     if (gray && !window.IsGray()) {
+                         RunFilter(GrayscaleFilter{}, window);
+                     }
+                     if (!result.IsGray()) {
+                         window.ToRGB();
+                     }
+                     result.Paste(window, source_x, source_y, x, y, height, width);
+                 });
+        result.SetMasks(image.GetMasks());
+        result.SetAlpha(image.ReleaseAlpha());
+    } else {
+        result = image;
+        pipeline(result);
+        if (gray && !result.IsGray()) {
+            RunFilter(GrayscaleFilter{}, result);
+        }
+    }
+    uint16_t bits_per_pixel = GetBitsPerPixel(chain, result);
+    std::string written = write(result, chain.output, bits_per_pixel);
+    if (!chain.stats.empty()) {
+        WriteStatisticsFile(chain.stats, result, bits_per_pixel);
+    }
+    if (footprint == Filter::FULL_FRAME) {
+        state.Clear();
+    } else {
+        state.Save(image, std::move(tiles), written);
+    }
+}
+
+// chains all start with the same applied filters, which the image has been through
+void ImageRedactor::ExecuteVariants(const std::vector<size_t>& chains, size_t applied, Image image,
+                                    const Writer& write) {
+    std::vector<std::vector<size_t>> branches;
+    for (size_t index : chains) {
+        const Chain& chain = chains_[index];
+        if (chain.options.size() == applied) {
+            if (chain.bits_per_pixel != 0 && chain.bits_per_pixel < 24 && !image.IsGray()) {
+                Image gray = image;
+                {
+                    GrayscaleFilter grayscale;
+                    Profiler::Stage stage(grayscale.GetName(), gray.GetHeight() * gray.GetWidth());
+                    RunFilter(grayscale, gray);
+                }
+                Output(chain, gray, write);
+            } else {
+                Output(chain, image, write);
+            }
+            continue;
+        }
+        auto branch = std::find_if(branches.begin(), branches.end(), [&](const std::vector<size_t>& other) {
+            return chains_[other[0]].options[applied] == chain.options[applied];
+        });
+        if (branch == branches.end()) {
+            branches.push_back({index});
+        } else {
+            branch->push_back(index);
+        }
+    }
+    for (size_t i = 0; i < branches.size(); ++i) {
+        const std::vector<size_t>& branch = branches[i];
+        const Chain& first = chains_[branch[0]];
+        // the branch shares the filters up to the first chain that ends or differs
+        size_t shared = first.options.size();
+        for (size_t index : branch) {
+            const std::vector<std::string>& options = chains_[index].options;
+            size_t common = applied;
+            while (common < shared && common < options.size() && options[common] == first.options[common]) {
+                ++common;
+            }
+            shared = common;
+        }
+        Pipeline pipeline({first.filters.begin() + applied, first.filters.begin() + shared}, GetStripRows());
+        // the last branch takes the image itself
+        Image branch_image;
+        if (i + 1 < branches.size()) {
+            branch_image = image;
+        } else {
+            branch_image = std::move(image);
+        }
+        pipeline(branch_image);
+        ExecuteVariants(branch, shared, std::move(branch_image), write);
+    }
+}
+
+uint16_t ImageRedactor::GetBitsPerPixel(const Chain& chain, const Image& image) {
+    if (chain.bits_per_pixel == 0) {
+        return image.HasAlpha() ? 32 : 24;
+    }
+    return chain.bits_per_pixel;
+}
+
+std::string ImageRedactor::GetKey(const Chain& chain) {
+    std::string key;
+    for (const FilterSpec& spec : chain.filters) {
+        key += spec.MakeFilter()->GetKey() + " ";
+    }
+    return key + "bpp " + std::to_string(chain.bits_per_pixel);
+}
+
+void ImageRedactor::ExecuteStreaming(const char* input) const {
+    const Chain& chain = chains_[0];
+    ReadBMP reader;
+    reader.Open(input);
+    WriteBMP writer;
+    bool created = false;
+    Pipeline pipeline(chain.filters, strip_rows_);
+    pipeline(
+        reader.GetHeight(), reader.GetWidth(),
+        [&reader](size_t x, size_t height) { return reader.ReadRows(x, height); },
+        [&](Image& window, size_t source_x, size_t x, size_t height) {
+            uint16_t bits_per_pixel = GetBitsPerPixel(chain, window);
+            if (bits_per_pixel < 24 && !window.IsGray()) {
+                RunFilter(GrayscaleFilter{}, window);
+            }
+            // the format of the output is only known once a strip has gone through the chain
+            if (!created) {
+                writer.Create(chain.output.c_str(), window, reader.GetHeight(), bits_per_pixel);
+                created = true;
+            }
+            writer.WriteRows(window, source_x, x, height);
+        });
+}
+
+size_t ImageRedactor::GetPeakMemory(Strategy strategy, size_t strip_rows, const ReadBMP& input, uintmax_t file_size,
+                                    const std::vector<Pipeline>& pipelines) const {
+    size_t height = input.GetHeight();
+    size_t width = input.GetWidth();
+    Image::Format format = input.GetFormat();
+    size_t image = Image::GetBytes(height, width, format);
+    size_t alpha = input.HasAlpha() ? Image::GetBytes(height, width, Image::Format::GRAY) : 0;
+    // the images blended with are held throughout
+    size_t auxiliary = 0;
+    std::set<const Image*> counted;
+    for (const Chain& chain : chains_) {
+        for (const FilterSpec& spec : chain.filters) {
+            if (spec.image && counted.insert(spec.image.get()).second) {
+                auxiliary += Image::GetBytes(spec.image->GetHeight(), spec.image->GetWidth(), spec.image->GetFormat());
+                if (spec.image->HasAlpha()) {
+                    auxiliary += Image::GetBytes(spec.image->GetHeight(), spec.image->GetWidth(), Image::Format::GRAY);
+                }
+            }
+        }
+    }
+    if (strategy == Strategy::STREAMING) {
+        if (chains_.size() != 1 || !cache_directory_.empty() || !chains_[0].stats.empty() ||
+            !chains_[0].state.empty()) {
+            return 0;
+        }
+        const Chain& chain = chains_[0];
+        const Pipeline& pipeline = pipelines[0];
+        size_t footprint = pipeline.GetFootprint(height, width);
+        if (footprint == Filter::FULL_FRAME) {
+            return 0;
+        }
+        size_t rows = std::min(height, strip_rows + 2 * std::min(footprint, height));
+        size_t window_alpha = input.HasAlpha() ? Image::GetBytes(rows, width, Image::Format::GRAY) : 0;
+        // outputs of less than 24 bits take the luminance of every window
+        Image::Format result = std::get<2>(pipeline.GetOutputShape(height, width, format));
+        bool gray = chain.bits_per_pixel != 0 && chain.bits_per_pixel < 24 && result == Image::Format::RGB;
+        size_t luma = gray ? Image::GetBytes(rows, width, Image::Format::GRAY) : 0;
+        return pipeline.GetStreamingMemory(height, width, format, strip_rows) + window_alpha + luma + auxiliary;
+    }
+    // decoding with -cache holds the file beside the image
+    size_t peak = image + alpha + (cache_directory_.empty() ? 0 : static_cast<size_t>(file_size));
+    size_t chains_peak = 0;
+    for (size_t i = 0; i < chains_.size(); ++i) {
+        const Chain& chain = chains_[i];
+        size_t chain_rows = strategy == Strategy::TILED ? strip_rows : 0;
+        size_t chain_peak = pipelines[i].GetPeakMemory(height, width, format, chain_rows);
+        // outputs of less than 24 bits take the luminance of a copy of the result
+        auto [result_height, result_width, result] = pipelines[i].GetOutputShape(height, width, format);
+        if (chain.bits_per_pixel != 0 && chain.bits_per_pixel < 24 && result == Image::Format::RGB) {
+            chain_peak = std::max(chain_peak, 2 * Image::GetBytes(result_height, result_width, result) +
+                                                  Image::GetBytes(result_height, result_width, Image::Format::GRAY));
+        }
+        chains_peak = std::max(chains_peak, chain_peak);
+    }
+    // the prefix tree of the chains copies the image where they part
+    chains_peak += (chains_.size() - 1) * (image + alpha);
+    return std::max(peak, chains_peak + alpha) + auxiliary;
+}
+
+std::string ImageRedactor::PlanMemory(const char* input) {
+    strategy_ = Strategy::IN_MEMORY;
+    strip_rows_ = 0;
+    if (max_memory_ == 0 && !explain_) {
+        return "";
+    }
+    ReadBMP reader;
+    reader.Open(input);
+    std::error_code error;
+    uintmax_t file_size = std::filesystem::file_size(input, error);
+    auxiliary_.Wait();
+    // the filters are built once for all the probes below, as wide blurs take long to build
+    std::vector<Pipeline> pipelines;
+    for (const Chain& chain : chains_) {
+        std::vector<FilterSpec> plan = Pipeline::Plan(chain.filters, reader.GetHeight(), reader.GetWidth());
+        pipelines.emplace_back(plan.empty() ? chain.filters : plan);
+    }
+    size_t height = std::max<size_t>(reader.GetHeight(), 1);
+    // the tallest strips within the budget, 0 if none is; DEFAULT_STRIP_ROWS without a budget
+    auto fit = [&](Strategy strategy) -> size_t {
+        if (max_memory_ == 0) {
+            return std::min(height, DEFAULT_STRIP_ROWS);
+        }
+        size_t low = 0;
+        size_t high = height;
+        while (low < high) {
+            size_t middle = (low + high + 1) / 2;
+            size_t peak = GetPeakMemory(strategy, middle, reader, file_size, pipelines);
+            if (peak != 0 && peak <= max_memory_) {
+                low = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+        return low;
+    };
+    size_t in_memory = GetPeakMemory(Strategy::IN_MEMORY, 0, reader, file_size, pipelines);
+    size_t tiled_rows = fit(Strategy::TILED);
+    size_t tiled = GetPeakMemory(Strategy::TILED, std::max<size_t>(tiled_rows, 1), reader, file_size, pipelines);
+    size_t streaming_rows = fit(Strategy::STREAMING);
+    size_t streaming = GetPeakMemory(Strategy::STREAMING, std::max<size_t>(streaming_rows, 1), reader, file_size,
+                                     pipelines);
+
+    if (max_memory_ != 0) {
+        if (in_memory <= max_memory_) {
+            strategy_ = Strategy::IN_MEMORY;
+        } else if (tiled_rows != 0) {
+            strategy_ = Strategy::TILED;
+            strip_rows_ = tiled_rows;
+        } else if (streaming_rows != 0) {
+            strategy_ = Strategy::STREAMING;
+            strip_rows_ = streaming_rows;
+        } else {
+            throw MemoryLimitExceeded(streaming != 0 ? std::min(tiled, streaming) : tiled);
+        }
+    }
+    if (!explain_) {
+        return "";
+    }
+    std::ostringstream explanation;
+    explanation << input << ": " << reader.GetWidth() << 'x' << reader.GetHeight() << ' '
+                << (reader.GetFormat() == Image::Format::GRAY ? "GRAY" : "RGB")
+                << (reader.HasAlpha() ? " with alpha" : "")
+                << ", " << FormatBytes(Image::GetBytes(reader.GetHeight(), reader.GetWidth(), reader.GetFormat()))
+                << " of pixels\n";
+    explanation << "in memory: peak " << FormatBytes(in_memory) << "\n";
+    explanation << "tiled, strips of " << std::max<size_t>(tiled_rows, 1) << " rows: peak " << FormatBytes(tiled)
+                << "\n";
+    if (streaming == 0) {
+        explanation << "streamed: not possible, it needs a single output without -cache, -stats or -incremental, "
+                       "and no filter reading the whole image\n";
+    } else {
+        explanation << "streamed, strips of " << std::max<size_t>(streaming_rows, 1) << " rows: peak "
+                    << FormatBytes(streaming) << "\n";
+    }
+    if (max_memory_ == 0) {
+        explanation << "no -max-memory: in memory\n";
+    } else {
+        const char* names[] = {"in memory", "tiled", "streamed"};
+        explanation << "-max-memory " << FormatBytes(max_memory_) << ": " << names[static_cast<size_t>(strategy_)];
+        if (strategy_ != Strategy::IN_MEMORY) {
+            explanation << ", strips of " << strip_rows_ << " rows";
+        }
+        explanation << "\n";
+    }
+    return explanation.str();
+}
+
+std::string ImageRedactor::PlanDeadline(const char* input) {
+    if (deadline_ == 0) {
+        return "";
+    }
+    auto start = std::chrono::steady_clock::now();
+    ReadBMP reader;
+    reader.Open(input);
+    auxiliary_.Wait();
+    size_t height = reader.GetHeight();
+    size_t width = reader.GetWidth();
+    Image::Format format = reader.GetFormat();
+    // the time planning took so far, which includes setting up the filters of the tiers estimated, such as the
+    // pyramids of approximate blurs, plus the estimate of decoding, running the chains and encoding. The filters of
+    // each chain are built once, for both its cost and the shape of its output; the run reuses what they set up
+    auto estimate = [&](const QualityTier& tier) {
+        long double decode = format == Image::Format::GRAY ? DECODE_GRAY_COST : DECODE_RGB_COST;
+        long double nanoseconds = static_cast<long double>(height) * width * decode / GetThreadCount();
+        for (const Chain& chain : chains_) {
+            std::vector<FilterSpec> specs = tier(chain.filters, height, width);
+            std::vector<FilterSpec> plan = Pipeline::Plan(specs, height, width);
+            Pipeline pipeline(plan.empty() ? specs : plan);
+            nanoseconds += pipeline.GetCost(height, width, format);
+            auto [result_height, result_width, result] = pipeline.GetOutputShape(height, width, format);
+            nanoseconds += static_cast<long double>(result_height) * result_width * ENCODE_COST / GetThreadCount();
+        }
+        std::chrono::duration<long double, std::milli> planning = std::chrono::steady_clock::now() - start;
+        return planning.count() + nanoseconds / Tuning::Get().speed / 1e6L;
+    };
+    // the first tier is the exact chain, which is what runs if no tier accepts the chains
+    const QualityTier* picked = &QualityTier::GetTiers().front();
+    long double milliseconds = estimate(*picked);
+    bool met = false;
+    for (const QualityTier& tier : QualityTier::GetTiers()) {
+        bool accepted = std::all_of(chains_.begin(), chains_.end(), [&](const Chain& chain) {
+            return tier.Accepts(chain.filters, height, width);
+        });
+        if (!accepted) {
+            continue;
+        }
+        long double tier_milliseconds = estimate(tier);
+        if (tier_milliseconds < milliseconds) {
+            picked = &tier;
+            milliseconds = tier_milliseconds;
+        }
+        if (tier_milliseconds <= deadline_) {
+            met = true;
+            break;
+        }
+    }
+
+    const QualityTier& tier = *picked;
+    bool blurs = std::any_of(chains_.begin(), chains_.end(), [](const Chain& chain) {
+        return std::any_of(chain.filters.begin(), chain.filters.end(), [](const FilterSpec& spec) {
+            return spec.kind == FilterSpec::Kind::GAUSSIAN_BLUR || spec.kind == FilterSpec::Kind::CHALK ||
+                   spec.kind == FilterSpec::Kind::SKETCH;
+        });
+    });
+    std::string description = tier.GetDescription(blurs);
+    if (tier.blur_error != 0 || tier.scale != 1) {
+        for (Chain& chain : chains_) {
+            std::vector<FilterSpec> specs = tier(chain.filters, height, width);
+            // the filters keep their options, marked with the tier, so that chains still share them; the resizes the
+            // tier adds are named by their keys
+            size_t offset = tier.scale > 1 ? 1 : 0;
+            std::vector<std::string> options;
+            for (size_t i = 0; i < specs.size(); ++i) {
+                if (i >= offset && i - offset < chain.options.size()) {
+                    options.push_back(chain.options[i - offset] + " (" + description + ")");
+                } else {
+                    options.push_back(specs[i].MakeFilter()->GetKey());
+                }
+            }
+            chain.filters = std::move(specs);
+            chain.options = std::move(options);
+        }
+    }
+    std::ostringstream report;
+    report << "-deadline " << std::setprecision(15) << deadline_ << " ms: " << description << ", estimated "
+           << std::fixed << std::setprecision(1) << milliseconds << " ms" << (met ? "" : ", the fastest there is")
+           << "\n";
+    return report.str();
+}
+
+size_t ImageRedactor::GetStripRows() const {
+    return strategy_ == Strategy::TILED ? strip_rows_ : 0;
+}
+
+bool ImageRedactor::IsProfiled() const {
+    return profile_;
+}
+
+const char* ImageRedactor::GetUnservedOption() const {
+    if (!cache_directory_.empty()) {
+        return "-cache";
+    }
+    if (cache_size_ != ResultCache::DEFAULT_MAX_SIZE) {
+        return "-cache-size";
+    }
+    for (const Chain& chain : chains_) {
+        if (!chain.state.empty()) {
+            return "-incremental";
+        }
+    }
+    if (profile_) {
+        return "-perf";
+    }
+    if (max_memory_ != 0) {
+        return "-max-memory";
+    }
+    if (explain_) {
+        return "-explain";
+    }
+    if (deadline_ != 0) {
+        return "-deadline";
+    }
+    return nullptr;
+}
+
+uint16_t ImageRedactor::GetBitsPerPixel() const {
+    return chains_.empty() ? GetBitsPerPixel(Chain(), image_) : GetBitsPerPixel(chains_[0], image_);
+}
+
+void ImageRedactor::Output(const Chain& chain, const Image& image, const Writer& write) {
+    uint16_t bits_per_pixel = GetBitsPerPixel(chain, image);
+    write(image, chain.output, bits_per_pixel);
+    if (!chain.stats.empty()) {
+        WriteStatisticsFile(chain.stats, image, bits_per_pixel);
+    }
+}
+
+void ImageRedactor::WriteStatistics(const Image& image) const {
+    if (!chains_.empty() && !chains_[0].stats.empty()) {
+        WriteStatisticsFile(chains_[0].stats, image, GetBitsPerPixel(chains_[0], image));
     }
 }
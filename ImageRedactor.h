@@ -1,16 +1,138 @@
 #pragma once
 
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AuxiliaryImages.h"
+#include "BMPio.h"
 #include "Image.h"
 #include "Filter.h"
+#include "Pipeline.h"
+#include "ResultCache.h"
 
 class ImageRedactor {
+public:
+    // called with every output of ExecuteVariants(), returns the path the output was written to
+    using Writer = std::function<std::string(const Image& image, const std::string& output, uint16_t bits_per_pixel)>;
+
+    // how ExecuteVariants() runs the chains: on the whole image, on strips of the image in memory, or on strips
+    // streamed from the input file to the output file
+    enum class Strategy { IN_MEMORY, TILED, STREAMING };
+
 private:
+    inline static const size_t DEFAULT_STRIP_ROWS = 256;
+    // rough nanoseconds per pixel of decoding RGB and GRAY files and of encoding any, on the machine the costs of the
+    // filters were measured on
+    inline static const long double DECODE_RGB_COST = 75;
+    inline static const long double DECODE_GRAY_COST = 45;
+    inline static const long double ENCODE_COST = 45;
+
+    // the filters making one output, with the options each of them was given
+    struct Chain {
+        std::string output;
+        std::vector<FilterSpec> filters;
+        std::vector<std::string> options;
+        // 0 keeps the depth of the image: 32 bits per pixel with alpha and 24 without it
+        uint16_t bits_per_pixel = 0;
+        // directory of the IncrementalState given with -incremental, empty without it
+        std::string state;
+        // file the ImageStatistics of the output are written to with -stats, empty without it
+        std::string stats;
+    };
+
     Image& image_;
+    // the chain of Parse(), or one chain per output of ParseVariants()
+    std::vector<Chain> chains_;
+    AuxiliaryImages auxiliary_;
+    // directory of the ResultCache given with -cache, empty without it, and its size limit given with -cache-size
+    std::string cache_directory_;
+    uintmax_t cache_size_ = ResultCache::DEFAULT_MAX_SIZE;
+    // whether -perf was given
+    bool profile_ = false;
+    // the budget given with -max-memory, 0 without it, and whether -explain was given
+    size_t max_memory_ = 0;
+    bool explain_ = false;
+    // the milliseconds given with -deadline, 0 without it
+    long double deadline_ = 0;
+    // what PlanMemory() picked, and the rows of the strips of TILED and STREAMING
+    Strategy strategy_ = Strategy::IN_MEMORY;
+    size_t strip_rows_ = 0;
+
+    void ParseChain(size_t argc, char** argv, Chain& chain);
+    static uint16_t GetBitsPerPixel(const Chain& chain, const Image& image);
+    // the keys of the filters of the chain and its depth
+    static std::string GetKey(const Chain& chain);
+    // writes the output of the chain, and its statistics with -stats
+    static void Output(const Chain& chain, const Image& image, const Writer& write);
+    void ExecuteVariants(const std::vector<size_t>& chains, size_t applied, Image image, const Writer& write);
+    // runs a chain with -incremental on its own
+    void ExecuteIncremental(const Chain& chain, Image image, const Writer& write) const;
+    // peak bytes of running the chains, through their pipelines planned for the image, on the image of the input file,
+    // whose headers were read, with the strategy and strip rows; 0 if the strategy cannot run them
+    size_t GetPeakMemory(Strategy strategy, size_t strip_rows, const ReadBMP& input, uintmax_t file_size,
+                         const std::vector<Pipeline>& pipelines) const;
+    // the strip rows pipelines on images in memory are given, 0 unless PlanMemory() picked TILED
+    size_t GetStripRows() const;
+    // runs the only chain streaming the input file to its output a strip at a time
+    void ExecuteStreaming(const char* input) const;
 
 public:
     explicit ImageRedactor(Image& source) : image_(source){};
 
+    // builds the filters; the images they blend with are only collected
+    void Parse(size_t argc, char** argv);
+
+    // builds several chains from "<output> [options] -- <output> [options] ...", all applied to the same image
+    void ParseVariants(size_t argc, char** argv);
+
+    // starts reading the collected images in the background, so that they load together with the source image
+    void LoadAuxiliary();
+
+    // waits for the collected images and applies the filters
+    void Execute();
+
     void Execute(size_t argc, char** argv);
 
-    void ApplyFilter(Filter& filter);
+    // waits for the collected images and passes every output of ParseVariants() to write. The chains form a prefix
+    // tree: filters at the start of several chains, given the same options, are applied once, and the image is only
+    // copied where the chains part
+    void ExecuteVariants(const Writer& write);
+
+    // with -max-memory or -explain, estimates from the headers of the input file the peak memory of running the chains
+    // on the whole image, on strips of the image in memory and on strips streamed from the input file to the output
+    // one, and picks the first of them within the budget, with strips as tall as fit. Returns the estimates with
+    // -explain, an empty string otherwise; throws MemoryLimitExceeded if nothing fits. Waits for the collected images
+    std::string PlanMemory(const char* input);
+
+    // with -deadline, estimates from the headers of the input file how long decoding, running the chains and encoding
+    // take for each QualityTier, from the exact one down, on top of the time planning took, and approximates the
+    // chains with the first within the deadline, or the fastest if none is. Returns the tier with its estimate, an
+    // empty string without -deadline. Waits for the collected images; comes before PlanMemory(), which sizes the
+    // approximated chains
+    std::string PlanDeadline(const char* input);
+
+    // reads the input file into the image and runs ExecuteVariants() the way PlanMemory() picked. With -cache, outputs
+    // found in the cache are copied from it instead, the file is only decoded if some are not, and those are added to
+    // the cache once written. Chains with -incremental only apply their filters to the parts of the image that changed
+    // since their last run. Streamed outputs are written straight to their file, without write
+    void ExecuteVariants(const char* input, const Writer& write);
+
+    void ApplyFilter(const Filter& filter);
+
+    // whether -perf asked for the counters of the stages of the run, see Profiler
+    bool IsProfiled() const;
+
+    // the first option given that --serve cannot honour, nullptr if there is none: the cache is keyed by the input
+    // file, the cache and the incremental state are only kept by ExecuteVariants() and the plans are only made by
+    // PlanMemory() and PlanDeadline(), which requests do not go through, and the counters of -perf count every thread
+    // of the process, whatever request it works on
+    const char* GetUnservedOption() const;
+
+    // bits per pixel of the output file requested with -bpp
+    uint16_t GetBitsPerPixel() const;
+
+    // writes the statistics of the image to the file given with -stats, if any
+    void WriteStatistics(const Image& image) const;
 };
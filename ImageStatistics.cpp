@@ -0,0 +1,160 @@
+#include "ImageStatistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <sstream>
+
+#include "Filter.h"
+#include "LookupTable.h"
+#include "Parallel.h"
+
+namespace {
+// the percentiles written by ToJSON()
+const std::array<long double, 7> PERCENTILES = {1, 5, 25, 50, 75, 95, 99};
+}  // namespace
+
+ImageStatistics::ImageStatistics(const Image& image, uint16_t bits_per_pixel)
+    : count_(image.GetHeight() * image.GetWidth()), height_(image.GetHeight()), width_(image.GetWidth()) {
+    std::mutex mutex;
+    ParallelFor(0, height_, ROWS_GRAIN, [&](size_t begin, size_t end) {
+        std::array<Histogram, CHANNELS> histograms{};
+        for (size_t x = begin; x < end; ++x) {
+            if (image.IsGray()) {
+                for (long double value : image.GrayRow(x)) {
+                    size_t level = ToLevel(value, bits_per_pixel);
+                    for (Histogram& histogram : histograms) {
+                        ++histogram[level];
+                    }
+                }
+            } else {
+                for (const Image::Pixel& pixel : image.PixelRow(x)) {
+                    ++histograms[0][ToLevel(pixel.red, bits_per_pixel)];
+                    ++histograms[1][ToLevel(pixel.green, bits_per_pixel)];
+                    ++histograms[2][ToLevel(pixel.blue, bits_per_pixel)];
+                    ++histograms[3][ToLevel(GrayscaleFilter::Luma(pixel), bits_per_pixel)];
+                }
+            }
+        }
+        std::lock_guard lock(mutex);
+        for (size_t c = 0; c < CHANNELS; ++c) {
+            for (size_t level = 0; level < LEVELS; ++level) {
+                histograms_[c][level] += histograms[c][level];
+            }
+        }
+    });
+}
+
+size_t ImageStatistics::ToLevel(long double value, uint16_t bits_per_pixel) {
+    // the same conversions as in WriteBMP, for values outside [0, 1] too
+    if (bits_per_pixel == 1) {
+        return value >= 0.5 ? LEVELS - 1 : 0;
+    }
+    return static_cast<unsigned char>(std::clamp<long double>(value, 0, 1) * Image::Pixel::DEPTH);
+}
+
+const ImageStatistics::Histogram& ImageStatistics::GetHistogram(Channel channel) const {
+    return histograms_[static_cast<size_t>(channel)];
+}
+
+uint64_t ImageStatistics::GetCount() const {
+    return count_;
+}
+
+long double ImageStatistics::GetMin(Channel channel) const {
+    const Histogram& histogram = GetHistogram(channel);
+    auto level = std::find_if(histogram.begin(), histogram.end(), [](uint64_t count) { return count != 0; });
+    return level == histogram.end() ? 0 : LookupTable::Grid()[level - histogram.begin()];
+}
+
+long double ImageStatistics::GetMax(Channel channel) const {
+    const Histogram& histogram = GetHistogram(channel);
+    auto level = std::find_if(histogram.rbegin(), histogram.rend(), [](uint64_t count) { return count != 0; });
+    return level == histogram.rend() ? 0 : LookupTable::Grid()[histogram.rend() - level - 1];
+}
+
+long double ImageStatistics::GetMean(Channel channel) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    const Histogram& histogram = GetHistogram(channel);
+    long double sum = 0;
+    for (size_t level = 0; level < LEVELS; ++level) {
+        sum += static_cast<long double>(level * histogram[level]);
+    }
+    return sum / static_cast<long double>(count_) / Image::Pixel::DEPTH;
+}
+
+long double ImageStatistics::GetPercentile(Channel channel, long double percent) const {
+    const Histogram& histogram = GetHistogram(channel);
+    auto rank = static_cast<uint64_t>(std::ceil(std::clamp<long double>(percent, 0, 100) / 100 * count_));
+    uint64_t seen = 0;
+    for (size_t level = 0; level < LEVELS; ++level) {
+        seen += histogram[level];
+        if (seen != 0 && seen >= rank) {
+            return LookupTable::Grid()[level];
+        }
+    }
+    return 0;
+}
+
+long double ImageStatistics::GetOtsuThreshold(Channel channel) const {
+    const Histogram& histogram = GetHistogram(channel);
+    long double total = 0;
+    for (size_t level = 0; level < LEVELS; ++level) {
+        total += static_cast<long double>(level * histogram[level]);
+    }
+    // with a single level, all the values are in the darker class
+    size_t last = LEVELS - 1;
+    while (last > 0 && histogram[last] == 0) {
+        --last;
+    }
+    size_t best = last;
+    long double best_variance = -1;
+    uint64_t darker = 0;
+    long double darker_total = 0;
+    for (size_t level = 0; level + 1 < LEVELS; ++level) {
+        darker += histogram[level];
+        darker_total += static_cast<long double>(level * histogram[level]);
+        uint64_t brighter = count_ - darker;
+        if (darker == 0) {
+            continue;
+        }
+        if (brighter == 0) {
+            break;
+        }
+        long double difference = darker_total / darker - (total - darker_total) / brighter;
+        // the variance between the classes times the square of the count: the variance within them is the least
+        // where this is the greatest
+        long double variance = static_cast<long double>(darker) * brighter * difference * difference;
+        if (variance > best_variance) {
+            best_variance = variance;
+            best = level;
+        }
+    }
+    if (best + 1 == LEVELS) {
+        return 1;
+    }
+    return (LookupTable::Grid()[best] + LookupTable::Grid()[best + 1]) / 2;
+}
+
+std::string ImageStatistics::ToJSON() const {
+    std::ostringstream json;
+    json << "{\n  \"height\": " << height_ << ",\n  \"width\": " << width_ << ",\n  \"channels\": {";
+    for (size_t c = 0; c < CHANNELS; ++c) {
+        auto channel = static_cast<Channel>(c);
+        json << (c == 0 ? "" : ",") << "\n    \"" << CHANNEL_NAMES[c] << "\": {\n      \"min\": " << GetMin(channel)
+             << ",\n      \"max\": " << GetMax(channel) << ",\n      \"mean\": " << GetMean(channel)
+             << ",\n      \"percentiles\": {";
+        for (size_t i = 0; i < PERCENTILES.size(); ++i) {
+            json << (i == 0 ? "" : ", ") << "\"" << PERCENTILES[i] << "\": " << GetPercentile(channel, PERCENTILES[i]);
+        }
+        json << "},\n      \"otsu\": " << GetOtsuThreshold(channel) << ",\n      \"histogram\": [";
+        for (size_t level = 0; level < LEVELS; ++level) {
+            json << (level == 0 ? "" : ", ") << histograms_[c][level];
+        }
+        json << "]\n    }";
+    }
+    json << "\n  }\n}\n";
+    return json.str();
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Image.h"
+
+// Histograms of the 8-bit levels the channels and the luminance of an image are written with, gathered in one
+// parallel pass over its rows: every range of rows fills histograms of its own, merged at the end. Minimums,
+// maximums, means, percentiles and Otsu's threshold are read off the histograms, so they describe the image as
+// written, in values from 0 to 1: a 1-bit file only holds levels 0 and 255.
+class ImageStatistics {
+public:
+    // the channels of a GRAY image are all its luminance
+    enum class Channel { RED, GREEN, BLUE, LUMA };
+    inline static const size_t LEVELS = 256;
+    using Histogram = std::array<uint64_t, LEVELS>;
+
+private:
+    inline static const size_t ROWS_GRAIN = 16;
+    inline static const size_t CHANNELS = 4;
+    inline static const std::array<const char*, CHANNELS> CHANNEL_NAMES = {"red", "green", "blue", "luma"};
+    std::array<Histogram, CHANNELS> histograms_{};
+    uint64_t count_ = 0;
+    size_t height_ = 0;
+    size_t width_ = 0;
+
+public:
+    // the bits per pixel of the file the image is written to
+    explicit ImageStatistics(const Image& image, uint16_t bits_per_pixel = 24);
+
+    // the level WriteBMP writes the value as with the given bits per pixel
+    static size_t ToLevel(long double value, uint16_t bits_per_pixel = 24);
+
+    const Histogram& GetHistogram(Channel channel) const;
+    uint64_t GetCount() const;
+    // 0 for empty images
+    long double GetMin(Channel channel) const;
+    long double GetMax(Channel channel) const;
+    long double GetMean(Channel channel) const;
+    // the least value at least percent of the values are not above
+    long double GetPercentile(Channel channel, long double percent) const;
+    // the threshold between the darker and the brighter class of values that Otsu's method gives, the one that keeps
+    // the variance within the classes least: halfway between the last level of the darker class and the next one,
+    // so that the brighter class is the values above it
+    long double GetOtsuThreshold(Channel channel) const;
+
+    // an object with the size of the image and, for every channel, the values above and the histogram
+    std::string ToJSON() const;
+};
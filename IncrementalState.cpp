@@ -0,0 +1,139 @@
+#include "IncrementalState.h"
+
+#include <fstream>
+
+#include "BMPio.h"
+#include "Hash.h"
+#include "ImageException.h"
+#include "Parallel.h"
+
+namespace {
+const size_t TILES_GRAIN = 16;
+}  // namespace
+
+IncrementalState::IncrementalState(std::filesystem::path directory, const std::string& chain_key, size_t tile_size)
+    : directory_(std::move(directory)), chain_(Hash64(chain_key.data(), chain_key.size())), tile_size_(tile_size) {
+    std::ifstream file(GetTilesPath(), std::ios::binary);
+    uint64_t header[8] = {};
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header))) {
+        return;
+    }
+    if (header[0] != MAGIC || header[1] != chain_ || header[2] != tile_size_) {
+        return;
+    }
+    std::vector<uint64_t> tiles(header[7]);
+    std::streamsize size = static_cast<std::streamsize>(tiles.size() * sizeof(uint64_t));
+    if (!file.read(reinterpret_cast<char*>(tiles.data()), size)) {
+        return;
+    }
+    height_ = header[3];
+    width_ = header[4];
+    res_ = {static_cast<int32_t>(header[5]), static_cast<int32_t>(header[6])};
+    tiles_ = std::move(tiles);
+}
+
+std::filesystem::path IncrementalState::GetTilesPath() const {
+    return directory_ / "tiles";
+}
+
+std::filesystem::path IncrementalState::GetOutputPath() const {
+    return directory_ / "output.bmp";
+}
+
+std::vector<uint64_t> IncrementalState::HashTiles(const Image& image, const TiledExecutor& tiled) {
+    size_t tile_size = tiled.GetTileSize();
+    size_t tile_columns = tiled.GetTileColumns(image);
+    std::vector<uint64_t> tiles(tiled.GetTileRows(image) * tile_columns);
+    ParallelFor(0, tiles.size(), TILES_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t tile = begin; tile < end; ++tile) {
+            size_t x = tile / tile_columns * tile_size;
+            size_t y = tile % tile_columns * tile_size;
+            tiles[tile] = image.Hash(x, y, std::min(tile_size, image.GetHeight() - x),
+                                     std::min(tile_size, image.GetWidth() - y));
+        }
+    });
+    return tiles;
+}
+
+std::optional<std::vector<size_t>> IncrementalState::GetDirty(const Image& image, const std::vector<uint64_t>& tiles,
+                                                              size_t footprint, const TiledExecutor& tiled) const {
+    if (tiles_.empty() || tiles_.size() != tiles.size() || height_ != image.GetHeight() ||
+        width_ != image.GetWidth() || res_ != image.GetRes() || footprint == Filter::FULL_FRAME ||
+        !std::filesystem::exists(GetOutputPath())) {
+        return std::nullopt;
+    }
+    // a changed tile reaches the tiles within the footprint of it
+    size_t reach = (footprint + tile_size_ - 1) / tile_size_;
+    size_t tile_rows = tiled.GetTileRows(image);
+    size_t tile_columns = tiled.GetTileColumns(image);
+    std::vector<bool> dirty(tiles.size());
+    for (size_t tile = 0; tile < tiles.size(); ++tile) {
+        if (tiles[tile] == tiles_[tile]) {
+            continue;
+        }
+        size_t row = tile / tile_columns;
+        size_t column = tile % tile_columns;
+        for (size_t i = row - std::min(row, reach); i < std::min(tile_rows, row + reach + 1); ++i) {
+            for (size_t j = column - std::min(column, reach); j < std::min(tile_columns, column + reach + 1); ++j) {
+                dirty[i * tile_columns + j] = true;
+            }
+        }
+    }
+    std::vector<size_t> result;
+    for (size_t tile = 0; tile < dirty.size(); ++tile) {
+        if (dirty[tile]) {
+            result.push_back(tile);
+        }
+    }
+    return result;
+}
+
+Image IncrementalState::LoadOutput() const {
+    Image output;
+    ReadBMP(GetOutputPath().c_str(), output);
+    return output;
+}
+
+void IncrementalState::Save(const Image& image, std::vector<uint64_t> tiles, const std::filesystem::path& output) {
+    std::filesystem::path temporary = directory_ / "tiles.tmp";
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    // without the tiles the output is never used, so a failure halfway leaves no state rather than a wrong one
+    Clear();
+    if (!std::filesystem::copy_file(output, GetOutputPath(), std::filesystem::copy_options::overwrite_existing,
+                                    error)) {
+        throw WriteFileError(GetOutputPath().c_str());
+    }
+    auto [hor_res, ver_res] = image.GetRes();
+    uint64_t header[8] = {MAGIC,
+                          chain_,
+                          tile_size_,
+                          image.GetHeight(),
+                          image.GetWidth(),
+                          static_cast<uint64_t>(hor_res),
+                          static_cast<uint64_t>(ver_res),
+                          tiles.size()};
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(tiles.data()),
+                   static_cast<std::streamsize>(tiles.size() * sizeof(uint64_t)));
+        if (!file) {
+            throw WriteFileError(temporary.c_str());
+        }
+    }
+    std::filesystem::rename(temporary, GetTilesPath(), error);
+    if (error) {
+        throw WriteFileError(GetTilesPath().c_str());
+    }
+    height_ = image.GetHeight();
+    width_ = image.GetWidth();
+    res_ = image.GetRes();
+    tiles_ = std::move(tiles);
+}
+
+void IncrementalState::Clear() {
+    std::error_code error;
+    std::filesystem::remove(GetTilesPath(), error);
+    tiles_.clear();
+}
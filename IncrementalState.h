@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Image.h"
+#include "TiledExecutor.h"
+
+// What -incremental keeps of a chain between runs, in a directory of its own: the hash of every tile of the last
+// input and the output made from it. The next run only applies the filters to the tiles that changed and to the
+// ones within the footprint of the chain from them, and pastes those into the last output.
+class IncrementalState {
+private:
+    inline static const uint64_t MAGIC = 0x31434e4950504d49;  // "IMPPINC1"
+    std::filesystem::path directory_;
+    uint64_t chain_;
+    size_t tile_size_;
+    // what the last input was; no tiles if there is no usable state
+    size_t height_ = 0;
+    size_t width_ = 0;
+    std::pair<int32_t, int32_t> res_;
+    std::vector<uint64_t> tiles_;
+
+    std::filesystem::path GetTilesPath() const;
+    std::filesystem::path GetOutputPath() const;
+
+public:
+    // reads the state of the chain with the given key, if the directory holds one
+    IncrementalState(std::filesystem::path directory, const std::string& chain_key, size_t tile_size);
+
+    // hashes of the tiles of the image, numbered as by TiledExecutor
+    static std::vector<uint64_t> HashTiles(const Image& image, const TiledExecutor& tiled);
+
+    // the tiles of the output that may differ from the last one for an input with the given tile hashes and a chain
+    // with the given footprint; nothing if the last run was of another chain or size, or there was none
+    std::optional<std::vector<size_t>> GetDirty(const Image& image, const std::vector<uint64_t>& tiles,
+                                                size_t footprint, const TiledExecutor& tiled) const;
+
+    // the last output, as read from its file
+    Image LoadOutput() const;
+
+    // replaces the state with the one of the image with the given tile hashes and the output written to path
+    void Save(const Image& image, std::vector<uint64_t> tiles, const std::filesystem::path& output);
+
+    // forgets the state, for chains that cannot run incrementally
+    void Clear();
+};
@@ -0,0 +1,40 @@
+#include "IntegralImage.h"
+
+#include <span>
+
+#include "Parallel.h"
+
+IntegralImage::IntegralImage(const Image& image)
+    : channels_(image.IsGray() ? 1 : 3),
+      stride_((image.GetWidth() + 1) * channels_),
+      sums_((image.GetHeight() + 1) * stride_) {
+    size_t height = image.GetHeight();
+    size_t width = image.GetWidth();
+    ParallelFor(0, height, ROWS_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            int64_t* row = sums_.data() + (x + 1) * stride_;
+            if (channels_ == 1) {
+                std::span<const long double> values = image.GrayRow(x);
+                for (size_t y = 0; y < width; ++y) {
+                    row[y + 1] = row[y] + ToFixed(values[y]);
+                }
+            } else {
+                std::span<const Image::Pixel> pixels = image.PixelRow(x);
+                for (size_t y = 0; y < width; ++y) {
+                    row[3 * y + 3] = row[3 * y] + ToFixed(pixels[y].red);
+                    row[3 * y + 4] = row[3 * y + 1] + ToFixed(pixels[y].green);
+                    row[3 * y + 5] = row[3 * y + 2] + ToFixed(pixels[y].blue);
+                }
+            }
+        }
+    });
+    ParallelFor(0, stride_, COLUMNS_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t x = 2; x <= height; ++x) {
+            int64_t* row = sums_.data() + x * stride_;
+            const int64_t* above = row - stride_;
+            for (size_t i = begin; i < end; ++i) {
+                row[i] += above[i];
+            }
+        }
+    });
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Image.h"
+
+// Summed-area table of an image: the sum of a channel over any rectangle in constant time, whatever its size. Values
+// are summed as 64-bit integers in fixed point with 32 fractional bits, so sums are exact: a rectangle has the same
+// sum in a window of a frame as in the whole frame, and frames of up to 2^31 pixels of values in [0, 1] fit. What the
+// rounding to 2^-32 loses is far below a level of an 8-bit channel.
+class IntegralImage {
+private:
+    inline static const long double SCALE = 4294967296.0L;
+    inline static const size_t ROWS_GRAIN = 16;
+    inline static const size_t COLUMNS_GRAIN = 1024;
+    // 1 for GRAY images, 3 for RGB ones
+    size_t channels_;
+    size_t stride_;
+    // (height + 1) x (width + 1) sums of the values above and to the left of a position, first row and column zero,
+    // with the channels of a position next to each other
+    std::vector<int64_t> sums_;
+
+    static int64_t ToFixed(long double value) {
+        return std::llround(value * SCALE);
+    }
+
+public:
+    // rows are summed along in parallel, then bands of columns of those sums are summed down in parallel
+    explicit IntegralImage(const Image& image);
+
+    // bytes the table of an image of the given size and format takes
+    static size_t GetBytes(size_t height, size_t width, Image::Format format) {
+        return (height + 1) * (width + 1) * (format == Image::Format::GRAY ? 1 : 3) * sizeof(int64_t);
+    }
+
+    size_t GetChannels() const {
+        return channels_;
+    }
+
+    // the value rounded the way it is summed, which is exactly the mean of a rectangle of such values
+    static long double Round(long double value) {
+        return static_cast<long double>(ToFixed(value)) / SCALE;
+    }
+
+    // mean of the channel over rows [x_begin, x_end) and columns [y_begin, y_end)
+    long double Mean(size_t channel, size_t x_begin, size_t x_end, size_t y_begin, size_t y_end) const {
+        const int64_t* top = sums_.data() + x_begin * stride_ + channel;
+        const int64_t* bottom = sums_.data() + x_end * stride_ + channel;
+        int64_t sum =
+            bottom[y_end * channels_] - bottom[y_begin * channels_] - top[y_end * channels_] + top[y_begin * channels_];
+        return static_cast<long double>(sum) / static_cast<long double>((x_end - x_begin) * (y_end - y_begin)) /
+               SCALE;
+    }
+};
@@ -0,0 +1,19 @@
+#include "LookupTable.h"
+
+const std::array<long double, LookupTable::SIZE>& LookupTable::Grid() {
+    static const std::array<long double, SIZE> GRID = [] {
+        std::array<long double, SIZE> grid;
+        for (size_t i = 0; i < SIZE; ++i) {
+            // the same division as in Image::Pixel(unsigned char, unsigned char, unsigned char)
+            grid[i] = static_cast<unsigned char>(i) / Image::Pixel::DEPTH;
+        }
+        return grid;
+    }();
+    return GRID;
+}
+
+LookupTable::LookupTable(std::function<long double(long double)> function) : function_(std::move(function)) {
+    for (size_t i = 0; i < SIZE; ++i) {
+        table_[i] = function_(Grid()[i]);
+    }
+}
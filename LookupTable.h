@@ -0,0 +1,32 @@
+#pragma once
+
+#include <array>
+#include <functional>
+
+#include "Image.h"
+
+// Values read from 8-bit files are k / 255. Functions of such values are tabulated by k, and the tables fall
+// back to the function itself for any other value, so the results do not depend on whether a table was hit.
+class LookupTable {
+private:
+    inline static const size_t SIZE = 256;
+    std::array<long double, SIZE> table_;
+    std::function<long double(long double)> function_;
+
+public:
+    // returns whether value is index / 255 for some index
+    static bool ToIndex(long double value, size_t& index) {
+        if (!(value >= 0 && value <= 1)) {
+            return false;
+        }
+        index = static_cast<size_t>(value * Image::Pixel::DEPTH + 0.5);
+        return Grid()[index] == value;
+    }
+    static const std::array<long double, SIZE>& Grid();
+
+    explicit LookupTable(std::function<long double(long double)> function);
+    long double operator()(long double value) const {
+        size_t index = 0;
+        return ToIndex(value, index) ? table_[index] : function_(value);
+    }
+};
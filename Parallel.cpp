@@ -0,0 +1,32 @@
+#include "Parallel.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "TaskGraph.h"
+#include "Tuning.h"
+
+size_t GetThreadCount() {
+    static const size_t THREAD_COUNT = std::max(1u, std::thread::hardware_concurrency());
+    size_t tuned = Tuning::Get().threads;
+    return tuned != 0 ? std::min(tuned, THREAD_COUNT) : THREAD_COUNT;
+}
+
+void ParallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body) {
+    if (begin >= end) {
+        return;
+    }
+    size_t size = end - begin;
+    size_t ranges = std::min(GetThreadCount(), (size + std::max<size_t>(grain, 1) - 1) / std::max<size_t>(grain, 1));
+    if (ranges <= 1) {
+        body(begin, end);
+        return;
+    }
+    TaskGraph graph;
+    for (size_t i = 0; i < ranges; ++i) {
+        graph.Add([&body, range_begin = begin + size * i / ranges, range_end = begin + size * (i + 1) / ranges]() {
+            body(range_begin, range_end);
+        });
+    }
+    graph.Run();
+}
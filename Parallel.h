@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// number of worker threads used by the parallel loops, the hardware threads unless --tune picked fewer
+size_t GetThreadCount();
+
+// splits [begin, end) into contiguous ranges of at least grain items and runs body(range_begin, range_end) on
+// them in parallel on the shared ThreadPool; the first exception thrown by a range is rethrown once the started ones
+// have finished
+void ParallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
@@ -0,0 +1,564 @@
+#include "Pipeline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <tuple>
+
+#include "Profiler.h"
+#include "TiledExecutor.h"
+
+FilterSpec FilterSpec::Crop(size_t width, size_t height) {
+    FilterSpec spec{Kind::CROP};
+    spec.width = width;
+    spec.height = height;
+    return spec;
+}
+
+FilterSpec FilterSpec::Grayscale() {
+    return FilterSpec{Kind::GRAYSCALE};
+}
+
+FilterSpec FilterSpec::Negative() {
+    return FilterSpec{Kind::NEGATIVE};
+}
+
+FilterSpec FilterSpec::Sharpening() {
+    return FilterSpec{Kind::SHARPENING};
+}
+
+FilterSpec FilterSpec::EdgeDetection(long double threshold) {
+    FilterSpec spec{Kind::EDGE_DETECTION};
+    spec.value = threshold;
+    return spec;
+}
+
+FilterSpec FilterSpec::AutomaticEdgeDetection() {
+    FilterSpec spec{Kind::EDGE_DETECTION};
+    spec.automatic = true;
+    return spec;
+}
+
+FilterSpec FilterSpec::GaussianBlur(long double sigma, long double max_error) {
+    FilterSpec spec{Kind::GAUSSIAN_BLUR};
+    spec.value = sigma;
+    spec.max_error = max_error;
+    return spec;
+}
+
+FilterSpec FilterSpec::ColorBurn(std::shared_ptr<const Image> image) {
+    FilterSpec spec{Kind::COLOR_BURN};
+    spec.image = std::move(image);
+    return spec;
+}
+
+FilterSpec FilterSpec::ColorDodge(std::shared_ptr<const Image> image) {
+    FilterSpec spec{Kind::COLOR_DODGE};
+    spec.image = std::move(image);
+    return spec;
+}
+
+FilterSpec FilterSpec::Multiply(std::shared_ptr<const Image> image) {
+    FilterSpec spec{Kind::MULTIPLY};
+    spec.image = std::move(image);
+    return spec;
+}
+
+FilterSpec FilterSpec::Screen(std::shared_ptr<const Image> image) {
+    FilterSpec spec{Kind::SCREEN};
+    spec.image = std::move(image);
+    return spec;
+}
+
+FilterSpec FilterSpec::Overlay(std::shared_ptr<const Image> image) {
+    FilterSpec spec{Kind::OVERLAY};
+    spec.image = std::move(image);
+    return spec;
+}
+
+FilterSpec FilterSpec::Chalk(long double sigma, long double max_error) {
+    FilterSpec spec{Kind::CHALK};
+    spec.value = sigma;
+    spec.max_error = max_error;
+    return spec;
+}
+
+FilterSpec FilterSpec::Sketch(long double sigma, long double max_error) {
+    FilterSpec spec{Kind::SKETCH};
+    spec.value = sigma;
+    spec.max_error = max_error;
+    return spec;
+}
+
+FilterSpec FilterSpec::Scale(size_t width, size_t height) {
+    FilterSpec spec{Kind::SCALE};
+    spec.width = width;
+    spec.height = height;
+    return spec;
+}
+
+FilterSpec FilterSpec::Thumbnail(size_t size) {
+    FilterSpec spec{Kind::THUMBNAIL};
+    spec.width = size;
+    return spec;
+}
+
+FilterSpec FilterSpec::Rotate(size_t degrees) {
+    FilterSpec spec{Kind::ROTATE};
+    spec.width = degrees;
+    return spec;
+}
+
+FilterSpec FilterSpec::FlipVertical() {
+    return FilterSpec{Kind::FLIP_VERTICAL};
+}
+
+FilterSpec FilterSpec::FlipHorizontal() {
+    return FilterSpec{Kind::FLIP_HORIZONTAL};
+}
+
+FilterSpec FilterSpec::BoxBlur(size_t radius) {
+    FilterSpec spec{Kind::BOX_BLUR};
+    spec.width = radius;
+    return spec;
+}
+
+FilterSpec FilterSpec::AdaptiveThreshold(size_t radius, long double offset) {
+    FilterSpec spec{Kind::ADAPTIVE_THRESHOLD};
+    spec.width = radius;
+    spec.value = offset;
+    return spec;
+}
+
+FilterSpec FilterSpec::Median(size_t radius) {
+    FilterSpec spec{Kind::MEDIAN};
+    spec.width = radius;
+    return spec;
+}
+
+FilterSpec FilterSpec::Threshold(long double threshold) {
+    FilterSpec spec{Kind::THRESHOLD};
+    spec.value = threshold;
+    return spec;
+}
+
+FilterSpec FilterSpec::AutomaticThreshold() {
+    FilterSpec spec{Kind::THRESHOLD};
+    spec.automatic = true;
+    return spec;
+}
+
+std::unique_ptr<Filter> FilterSpec::MakeFilter() const {
+    switch (kind) {
+        case Kind::CROP:
+            return std::make_unique<CropFilter>(width, height);
+        case Kind::GRAYSCALE:
+            return std::make_unique<GrayscaleFilter>();
+        case Kind::NEGATIVE:
+            return std::make_unique<NegativeFilter>();
+        case Kind::SHARPENING:
+            return std::make_unique<SharpeningFilter>();
+        case Kind::EDGE_DETECTION:
+            if (automatic) {
+                return std::make_unique<EdgeDetectionFilter>();
+            }
+            return std::make_unique<EdgeDetectionFilter>(value);
+        case Kind::GAUSSIAN_BLUR:
+            return std::make_unique<GaussianFilter>(value, max_error);
+        case Kind::COLOR_BURN:
+            return std::make_unique<ColorBurnFilter>(image);
+        case Kind::COLOR_DODGE:
+            return std::make_unique<ColorDodgeFilter>(image);
+        case Kind::MULTIPLY:
+            return std::make_unique<MultiplyFilter>(image);
+        case Kind::SCREEN:
+            return std::make_unique<ScreenFilter>(image);
+        case Kind::OVERLAY:
+            return std::make_unique<OverlayFilter>(image);
+        case Kind::CHALK:
+            return std::make_unique<ChalkFilter>(value, max_error);
+        case Kind::SKETCH:
+            return std::make_unique<SketchFilter>(value, max_error);
+        case Kind::SCALE:
+            return std::make_unique<ResizeFilter>(width, height);
+        case Kind::THUMBNAIL:
+            return std::make_unique<ThumbnailFilter>(width);
+        case Kind::ROTATE:
+            return std::make_unique<RotateFilter>(width);
+        case Kind::FLIP_VERTICAL:
+            return std::make_unique<FlipVerticalFilter>();
+        case Kind::FLIP_HORIZONTAL:
+            return std::make_unique<FlipHorizontalFilter>();
+        case Kind::BOX_BLUR:
+            return std::make_unique<BoxFilter>(width);
+        case Kind::ADAPTIVE_THRESHOLD:
+            return std::make_unique<AdaptiveThresholdFilter>(width, value);
+        case Kind::MEDIAN:
+            return std::make_unique<MedianFilter>(width);
+        case Kind::THRESHOLD:
+            if (automatic) {
+                return std::make_unique<OtsuThresholdFilter>();
+            }
+            return std::make_unique<ThresholdFilter>(value);
+    }
+    return nullptr;
+}
+
+std::pair<size_t, size_t> FilterSpec::GetSize(size_t height, size_t width) const {
+    switch (kind) {
+        case Kind::CROP:
+            return {std::min(this->height, height), std::min(this->width, width)};
+        case Kind::SCALE:
+            return {this->height, this->width};
+        case Kind::THUMBNAIL:
+            return ThumbnailFilter(this->width).GetSize(height, width);
+        case Kind::ROTATE:
+            return RotateFilter(this->width).GetSize(height, width);
+        default:
+            return {height, width};
+    }
+}
+
+namespace {
+// the filter with its sizes and radii narrowed for an image downscaled by factor, none of them below a pixel
+FilterSpec Narrow(FilterSpec spec, size_t factor) {
+    auto narrow = [factor](size_t length) {
+        return length == 0 ? 0 : std::max<size_t>((length + factor / 2) / factor, 1);
+    };
+    switch (spec.kind) {
+        case FilterSpec::Kind::CROP:
+        case FilterSpec::Kind::SCALE:
+            spec.height = narrow(spec.height);
+            spec.width = narrow(spec.width);
+            break;
+        case FilterSpec::Kind::THUMBNAIL:
+        case FilterSpec::Kind::BOX_BLUR:
+        case FilterSpec::Kind::ADAPTIVE_THRESHOLD:
+        case FilterSpec::Kind::MEDIAN:
+            spec.width = narrow(spec.width);
+            break;
+        case FilterSpec::Kind::GAUSSIAN_BLUR:
+        case FilterSpec::Kind::CHALK:
+        case FilterSpec::Kind::SKETCH:
+            spec.value /= factor;
+            break;
+        default:
+            break;
+    }
+    return spec;
+}
+}  // namespace
+
+const std::vector<QualityTier>& QualityTier::GetTiers() {
+    static const std::vector<QualityTier> tiers = {{0, 1}, {1, 1}, {4, 1}, {4, 2}, {4, 4}, {4, 8}};
+    return tiers;
+}
+
+std::string QualityTier::GetDescription(bool blurs) const {
+    std::string description;
+    if (scale > 1) {
+        description = "at 1/" + std::to_string(scale) + " scale";
+    }
+    if (blurs && blur_error != 0) {
+        std::ostringstream levels;
+        levels << blur_error;
+        description += (description.empty() ? "" : ", ") + std::string("blurs within ") + levels.str() +
+                       (blur_error == 1 ? " level" : " levels");
+    }
+    return description.empty() ? "exact" : description;
+}
+
+bool QualityTier::Accepts(const std::vector<FilterSpec>& specs, size_t height, size_t width) const {
+    if (scale == 1) {
+        return true;
+    }
+    for (const FilterSpec& spec : specs) {
+        if (spec.image) {
+            return false;
+        }
+    }
+    return height >= scale && width >= scale;
+}
+
+std::vector<FilterSpec> QualityTier::operator()(const std::vector<FilterSpec>& specs, size_t height,
+                                                 size_t width) const {
+    std::vector<FilterSpec> result;
+    if (scale > 1) {
+        result.push_back(Narrow(FilterSpec::Scale(width, height), scale));
+    }
+    for (const FilterSpec& spec : specs) {
+        FilterSpec& approximate = result.emplace_back(Narrow(spec, scale));
+        bool blurs = spec.kind == FilterSpec::Kind::GAUSSIAN_BLUR || spec.kind == FilterSpec::Kind::CHALK ||
+                     spec.kind == FilterSpec::Kind::SKETCH;
+        if (blurs) {
+            approximate.max_error = std::max(approximate.max_error, blur_error / Image::Pixel::DEPTH);
+        }
+    }
+    if (scale > 1) {
+        size_t exact_height = height;
+        size_t exact_width = width;
+        size_t result_height = result[0].height;
+        size_t result_width = result[0].width;
+        for (size_t i = 0; i < specs.size(); ++i) {
+            std::tie(exact_height, exact_width) = specs[i].GetSize(exact_height, exact_width);
+            std::tie(result_height, result_width) = result[i + 1].GetSize(result_height, result_width);
+        }
+        if (result_height != exact_height || result_width != exact_width) {
+            result.push_back(FilterSpec::Scale(exact_width, exact_height));
+        }
+    }
+    return result;
+}
+
+namespace {
+// whether the filter may run after a downscale by factor instead of before it, averages telling whether the
+// downscale averages blocks of pixels: negative commutes with any resampling up to rounding, grayscale only with
+// block averages, as the Lanczos kernel clamps each channel and the luma of clamped channels is not the clamped luma,
+// and a blur at least two output pixels wide hides the aliasing of the downscale once narrowed by the factor
+bool RunsAfterDownscale(const FilterSpec& spec, long double factor, bool averages) {
+    switch (spec.kind) {
+        case FilterSpec::Kind::NEGATIVE:
+            return true;
+        case FilterSpec::Kind::GRAYSCALE:
+            return averages;
+        case FilterSpec::Kind::GAUSSIAN_BLUR:
+            return std::abs(spec.value) >= 2 * factor;
+        default:
+            return false;
+    }
+}
+
+// runs of point filters are merged into a single LutFilter pass
+std::vector<std::unique_ptr<Filter>> FusePointFilters(std::vector<std::unique_ptr<Filter>> filters) {
+    std::vector<std::unique_ptr<Filter>> fused;
+    std::vector<std::unique_ptr<PointFilter>> run;
+    auto flush = [&fused, &run]() {
+        if (run.size() == 1) {
+            fused.emplace_back(std::move(run[0]));
+        } else if (run.size() > 1) {
+            fused.emplace_back(std::make_unique<LutFilter>(std::move(run)));
+        }
+        run.clear();
+    };
+    for (auto& filter : filters) {
+        if (dynamic_cast<PointFilter*>(filter.get()) != nullptr) {
+            run.emplace_back(static_cast<PointFilter*>(filter.release()));
+        } else {
+            flush();
+            fused.emplace_back(std::move(filter));
+        }
+    }
+    flush();
+    return fused;
+}
+}  // namespace
+
+Pipeline::Pipeline(const std::vector<FilterSpec>& specs, size_t strip_rows) : specs_(specs), strip_rows_(strip_rows) {
+    std::vector<std::unique_ptr<Filter>> filters;
+    for (const FilterSpec& spec : specs) {
+        filters.push_back(spec.MakeFilter());
+    }
+    filters_ = FusePointFilters(std::move(filters));
+}
+
+std::vector<const Filter*> Pipeline::GetFilters() const {
+    std::vector<const Filter*> filters;
+    for (const auto& filter : filters_) {
+        filters.push_back(filter.get());
+    }
+    return filters;
+}
+
+std::vector<FilterSpec> Pipeline::Plan(const std::vector<FilterSpec>& specs, size_t height, size_t width) {
+    std::vector<FilterSpec> plan = specs;
+    bool moved = false;
+    // filters before a downscale are not moved past an earlier one
+    size_t fixed = 0;
+    for (size_t i = 0; i < plan.size(); ++i) {
+        auto [new_height, new_width] = plan[i].GetSize(height, width);
+        bool resizes = plan[i].kind == FilterSpec::Kind::SCALE || plan[i].kind == FilterSpec::Kind::THUMBNAIL;
+        if (resizes && new_height != 0 && new_width != 0) {
+            long double factor = std::min(static_cast<long double>(height) / new_height,
+                                          static_cast<long double>(width) / new_width);
+            // ResizeFilter averages blocks when shrinking by whole factors along both sides
+            bool averages = height % new_height == 0 && width % new_width == 0;
+            size_t first = i;
+            while (factor > 1 && first > fixed && RunsAfterDownscale(plan[first - 1], factor, averages)) {
+                --first;
+            }
+            for (size_t j = first; j < i; ++j) {
+                if (plan[j].kind == FilterSpec::Kind::GAUSSIAN_BLUR) {
+                    plan[j].value /= factor;
+                }
+            }
+            std::rotate(plan.begin() + first, plan.begin() + i, plan.begin() + i + 1);
+            moved = moved || first < i;
+        }
+        if (resizes || plan[i].kind == FilterSpec::Kind::CROP) {
+            fixed = i + 1;
+        }
+        height = new_height;
+        width = new_width;
+    }
+    return moved ? plan : std::vector<FilterSpec>();
+}
+
+void Pipeline::operator()(Image& image) const {
+    std::vector<FilterSpec> plan = Plan(specs_, image.GetHeight(), image.GetWidth());
+    if (!plan.empty()) {
+        Pipeline(plan, strip_rows_).Run(image);
+    } else {
+        Run(image);
+    }
+}
+
+void Pipeline::Run(Image& image) const {
+    TiledExecutor tiled;
+    std::vector<const Filter*> run;
+    auto flush = [this, &image, &tiled, &run]() {
+        if (strip_rows_ != 0 && !run.empty()) {
+            std::string name = "strips";
+            for (size_t i = 0; i < run.size(); ++i) {
+                name += (i == 0 ? " " : " + ") + run[i]->GetName();
+            }
+            Profiler::Stage stage(std::move(name), image.GetHeight() * image.GetWidth());
+            StripExecutor strips(strip_rows_);
+            strips(run, image);
+        } else if (tiled.Accepts(run, image)) {
+            // the tiles run in parallel, so the -perf stage is the whole run
+            std::string name = "tiled";
+            for (size_t i = 0; i < run.size(); ++i) {
+                name += (i == 0 ? " " : " + ") + run[i]->GetName();
+            }
+            Profiler::Stage stage(std::move(name), image.GetHeight() * image.GetWidth());
+            tiled(run, image);
+        } else {
+            for (const Filter* filter : run) {
+                Profiler::Stage stage(filter->GetName(), image.GetHeight() * image.GetWidth());
+                RunFilter(*filter, image);
+            }
+        }
+        run.clear();
+    };
+    for (const auto& filter : filters_) {
+        if (filter->GetFootprint(image.GetHeight(), image.GetWidth()) == Filter::FULL_FRAME) {
+            flush();
+            Profiler::Stage stage(filter->GetName(), image.GetHeight() * image.GetWidth());
+            RunFilter(*filter, image);
+        } else {
+            run.push_back(filter.get());
+        }
+    }
+    flush();
+}
+
+size_t Pipeline::GetFootprint(size_t height, size_t width) const {
+    return TiledExecutor::GetFootprint(GetFilters(), height, width);
+}
+
+long double Pipeline::GetCost(size_t height, size_t width, Image::Format format) const {
+    std::vector<FilterSpec> plan = Plan(specs_, height, width);
+    if (!plan.empty()) {
+        return Pipeline(plan).GetCost(height, width, format);
+    }
+    long double cost = 0;
+    for (const auto& filter : filters_) {
+        cost += filter->GetCost(height, width, format);
+        std::tie(height, width) = filter->GetSize(height, width);
+        format = filter->GetFormat(format);
+    }
+    return cost;
+}
+
+size_t Pipeline::GetPeakMemory(size_t height, size_t width, Image::Format format) const {
+    return GetPeakMemory(height, width, format, strip_rows_);
+}
+
+size_t Pipeline::GetPeakMemory(size_t height, size_t width, Image::Format format, size_t strip_rows) const {
+    std::vector<FilterSpec> plan = Plan(specs_, height, width);
+    if (!plan.empty()) {
+        return Pipeline(plan).GetPeakMemory(height, width, format, strip_rows);
+    }
+    size_t peak = Image::GetBytes(height, width, format);
+    TiledExecutor tiled;
+    std::vector<const Filter*> run;
+    // the same runs as Run() makes
+    auto flush = [&]() {
+        if (run.empty()) {
+            return;
+        }
+        Image::Format result = format;
+        for (const Filter* filter : run) {
+            result = filter->GetFormat(result);
+        }
+        size_t image = std::max(Image::GetBytes(height, width, format), Image::GetBytes(height, width, result));
+        if (strip_rows != 0) {
+            // the rows the next strip reads above it stay beside the result
+            StripExecutor strips(strip_rows);
+            size_t halo = std::min(TiledExecutor::GetFootprint(run, height, width), height);
+            peak = std::max(peak, image + Image::GetBytes(halo, width, format) +
+                                      strips.GetWindowMemory(run, height, width, format));
+        } else if (tiled.Accepts(run, height, width)) {
+            // the result beside the image, and a tile with its halo per thread
+            StripExecutor tile(tiled.GetTileSize());
+            size_t tile_memory = tile.GetWindowMemory(run, height, std::min(width, 3 * tiled.GetTileSize()), format);
+            peak = std::max(peak, Image::GetBytes(height, width, format) + Image::GetBytes(height, width, result) +
+                                      GetThreadCount() * tile_memory);
+        } else {
+            for (const Filter* filter : run) {
+                peak = std::max(peak, Image::GetBytes(height, width, format) +
+                                          filter->GetWorkspace(height, width, format));
+                format = filter->GetFormat(format);
+            }
+        }
+        format = result;
+        run.clear();
+    };
+    for (const auto& filter : filters_) {
+        if (filter->GetFootprint(height, width) == Filter::FULL_FRAME) {
+            flush();
+            peak = std::max(peak, Image::GetBytes(height, width, format) + filter->GetWorkspace(height, width, format));
+            std::tie(height, width) = filter->GetSize(height, width);
+            format = filter->GetFormat(format);
+        } else {
+            run.push_back(filter.get());
+        }
+    }
+    flush();
+    return peak;
+}
+
+size_t Pipeline::GetStreamingMemory(size_t height, size_t width, Image::Format format) const {
+    return GetStreamingMemory(height, width, format, strip_rows_);
+}
+
+size_t Pipeline::GetStreamingMemory(size_t height, size_t width, Image::Format format, size_t strip_rows) const {
+    return StripExecutor(strip_rows).GetWindowMemory(GetFilters(), height, width, format);
+}
+
+std::tuple<size_t, size_t, Image::Format> Pipeline::GetOutputShape(size_t height, size_t width,
+                                                                   Image::Format format) const {
+    for (const auto& filter : filters_) {
+        std::tie(height, width) = filter->GetSize(height, width);
+        format = filter->GetFormat(format);
+    }
+    return {height, width, format};
+}
+
+void Pipeline::operator()(size_t height, size_t width, const StripExecutor::Source& source,
+                          const StripExecutor::Sink& sink) const {
+    std::vector<const Filter*> filters = GetFilters();
+    std::string name = "streamed";
+    for (size_t i = 0; i < filters.size(); ++i) {
+        name += (i == 0 ? " " : " + ") + filters[i]->GetName();
+    }
+    Profiler::Stage stage(std::move(name), height * width);
+    StripExecutor strips(strip_rows_);
+    strips(filters, height, width, source, sink);
+}
+
+void Pipeline::operator()(const Image& image, const TiledExecutor& tiled, const std::vector<size_t>& tiles,
+                          const TiledExecutor::Sink& sink) const {
+    tiled(GetFilters(), image, tiles, sink);
+}
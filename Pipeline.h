@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "Filter.h"
+#include "Image.h"
+#include "StripExecutor.h"
+#include "TiledExecutor.h"
+
+// One filter of a Pipeline with its arguments, made with the functions named after the options of the command line.
+struct FilterSpec {
+    enum class Kind {
+        CROP,
+        GRAYSCALE,
+        NEGATIVE,
+        SHARPENING,
+        EDGE_DETECTION,
+        GAUSSIAN_BLUR,
+        COLOR_BURN,
+        COLOR_DODGE,
+        MULTIPLY,
+        SCREEN,
+        OVERLAY,
+        CHALK,
+        SKETCH,
+        SCALE,
+        THUMBNAIL,
+        ROTATE,
+        FLIP_VERTICAL,
+        FLIP_HORIZONTAL,
+        BOX_BLUR,
+        ADAPTIVE_THRESHOLD,
+        MEDIAN,
+        THRESHOLD
+    };
+
+    Kind kind;
+    // the size of the crop or the scale; the side of the thumbnail, the degrees of the rotation or the radius of the
+    // window in width
+    size_t width = 0;
+    size_t height = 0;
+    // the threshold, the sigma or the offset of the adaptive threshold
+    long double value = 0;
+    // whether the threshold is picked from the image instead, with Otsu's method
+    bool automatic = false;
+    // how far an approximate blur may be from the exact one, 0 for the exact blur
+    long double max_error = 0;
+    // the image blended with, which must be loaded by the time the pipeline runs
+    std::shared_ptr<const Image> image;
+
+    static FilterSpec Crop(size_t width, size_t height);
+    static FilterSpec Grayscale();
+    static FilterSpec Negative();
+    static FilterSpec Sharpening();
+    static FilterSpec EdgeDetection(long double threshold);
+    static FilterSpec AutomaticEdgeDetection();
+    static FilterSpec GaussianBlur(long double sigma, long double max_error = 0);
+    static FilterSpec ColorBurn(std::shared_ptr<const Image> image);
+    static FilterSpec ColorDodge(std::shared_ptr<const Image> image);
+    static FilterSpec Multiply(std::shared_ptr<const Image> image);
+    static FilterSpec Screen(std::shared_ptr<const Image> image);
+    static FilterSpec Overlay(std::shared_ptr<const Image> image);
+    static FilterSpec Chalk(long double sigma, long double max_error = 0);
+    static FilterSpec Sketch(long double sigma, long double max_error = 0);
+    static FilterSpec Scale(size_t width, size_t height);
+    static FilterSpec Thumbnail(size_t size);
+    static FilterSpec Rotate(size_t degrees);
+    static FilterSpec FlipVertical();
+    static FilterSpec FlipHorizontal();
+    static FilterSpec BoxBlur(size_t radius);
+    static FilterSpec AdaptiveThreshold(size_t radius, long double offset);
+    static FilterSpec Median(size_t radius);
+    static FilterSpec Threshold(long double threshold);
+    static FilterSpec AutomaticThreshold();
+
+    std::unique_ptr<Filter> MakeFilter() const;
+
+    // height and width the filter gives an image of the given size
+    std::pair<size_t, size_t> GetSize(size_t height, size_t width) const;
+};
+
+// A cheaper approximation of a chain of filters, for -deadline: the blurs go through a Gaussian pyramid within an
+// error, and the whole chain may run on the image downscaled by a factor, with its sizes and radii narrowed by it,
+// before the result is scaled back up to the size the exact chain gives.
+struct QualityTier {
+    // in levels out of 255, 0 to leave the blurs as they were given
+    long double blur_error = 0;
+    // 1 to run the chain at full size
+    size_t scale = 1;
+
+    // from the exact chain to the coarsest approximation
+    static const std::vector<QualityTier>& GetTiers();
+
+    // the blur error is left out for chains without blurs, which it leaves as they are
+    std::string GetDescription(bool blurs = true) const;
+
+    // whether the tier can approximate the chain on an image of the given size: blends need the image at full size
+    // to overlap the second one as given, and the downscaled image keeps at least a pixel along each side
+    bool Accepts(const std::vector<FilterSpec>& specs, size_t height, size_t width) const;
+
+    // the chain approximated for an image of the given size; when the tier scales, the first filter is the downscale
+    // and the filters after the given ones only scale the result back up
+    std::vector<FilterSpec> operator()(const std::vector<FilterSpec>& specs, size_t height, size_t width) const;
+};
+
+// A chain of filters built once and applied in place to any number of images, from any number of threads at once.
+// Runs of point filters are merged into lookup tables, and runs of filters reading only near pixels are applied
+// tile by tile. Downscales run ahead of the filters before them that give nearly the same result on fewer pixels.
+// Given a number of strip rows, the runs of filters reading only near pixels go through a StripExecutor instead,
+// keeping little more than one image in memory.
+class Pipeline {
+private:
+    std::vector<FilterSpec> specs_;
+    std::vector<std::unique_ptr<Filter>> filters_;
+    // 0 to run the filters on the whole image
+    size_t strip_rows_;
+
+    std::vector<const Filter*> GetFilters() const;
+
+    // applies the filters in the order they were given
+    void Run(Image& image) const;
+
+public:
+    explicit Pipeline(const std::vector<FilterSpec>& specs, size_t strip_rows = 0);
+
+    // the chain with downscales moved ahead of the filters before them that tolerate it, for an image of the given
+    // size; empty if nothing moves. A pipeline of the planned chain plans nothing more for that size
+    static std::vector<FilterSpec> Plan(const std::vector<FilterSpec>& specs, size_t height, size_t width);
+
+    // errors are thrown as FilterException, naming the filter
+    void operator()(Image& image) const;
+
+    // sum of the footprints of the filters in a frame of the given size, Filter::FULL_FRAME if one of them needs the
+    // whole frame
+    size_t GetFootprint(size_t height, size_t width) const;
+
+    // the most bytes the image and what the filters allocate beside it take at once while the pipeline runs on an
+    // image of the given size and format, without its alpha plane
+    size_t GetPeakMemory(size_t height, size_t width, Image::Format format) const;
+    // the same with strips of the given rows instead of the ones the pipeline was given, 0 for the whole image
+    size_t GetPeakMemory(size_t height, size_t width, Image::Format format, size_t strip_rows) const;
+
+    // the same for streaming an image through the pipeline, a strip at a time
+    size_t GetStreamingMemory(size_t height, size_t width, Image::Format format) const;
+    size_t GetStreamingMemory(size_t height, size_t width, Image::Format format, size_t strip_rows) const;
+
+    // the size and format the filters leave an image of the given size and format in
+    std::tuple<size_t, size_t, Image::Format> GetOutputShape(size_t height, size_t width, Image::Format format) const;
+
+    // rough nanoseconds the filters take on an image of the given size and format, summed from Filter::GetCost()
+    long double GetCost(size_t height, size_t width, Image::Format format) const;
+
+    // streams a frame of the given size from source through the filters to sink, a strip of the strip rows the
+    // pipeline was given at a time; none of the filters may need the whole frame
+    void operator()(size_t height, size_t width, const StripExecutor::Source& source,
+                    const StripExecutor::Sink& sink) const;
+
+    // applies the filters to the given tiles of the image only; none of the filters may need the whole frame
+    void operator()(const Image& image, const TiledExecutor& tiled, const std::vector<size_t>& tiles,
+                    const TiledExecutor::Sink& sink) const;
+};
@@ -0,0 +1,183 @@
+#include "Profiler.h"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+struct CounterType {
+    uint32_t type;
+    uint64_t config;
+    const char* name;
+};
+
+const std::array<CounterType, Profiler::COUNTERS> COUNTER_TYPES = {{
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "CPU time"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "LLC misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch misses"},
+}};
+
+int OpenCounter(const CounterType& counter) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter.type;
+    attr.config = counter.config;
+    // the threads started later are counted too
+    attr.inherit = 1;
+    // user space only, which is all perf_event_paranoid 2 allows
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+size_t Index(Profiler::Counter counter) {
+    return static_cast<size_t>(counter);
+}
+
+// the cell of a counter in the report, n/a if it was not available
+std::string Cell(long double value, bool available, int precision = 0) {
+    if (!available) {
+        return "n/a";
+    }
+    std::ostringstream cell;
+    cell << std::fixed << std::setprecision(precision) << value;
+    return cell.str();
+}
+}  // namespace
+
+Profiler::Stage::Stage(std::string name, size_t pixels)
+    : name_(std::move(name)), pixels_(pixels), active_(Profiler::Instance().IsEnabled()) {
+    if (active_) {
+        start_counts_ = Profiler::Instance().Read();
+        start_ = std::chrono::steady_clock::now();
+    }
+}
+
+Profiler::Stage::~Stage() {
+    if (!active_) {
+        return;
+    }
+    auto end = std::chrono::steady_clock::now();
+    Profiler& profiler = Profiler::Instance();
+    Reading counts = profiler.Read();
+    for (size_t i = 0; i < COUNTERS; ++i) {
+        counts[i] -= start_counts_[i];
+    }
+    long double milliseconds = std::chrono::duration<long double, std::milli>(end - start_).count();
+    profiler.Add({std::move(name_), pixels_, milliseconds, counts});
+}
+
+void Profiler::Stage::SetPixels(size_t pixels) {
+    pixels_ = pixels;
+}
+
+Profiler::Profiler() {
+    descriptors_.fill(-1);
+}
+
+Profiler::~Profiler() {
+    for (int descriptor : descriptors_) {
+        if (descriptor >= 0) {
+            close(descriptor);
+        }
+    }
+}
+
+Profiler& Profiler::Instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+void Profiler::Enable() {
+    if (enabled_) {
+        return;
+    }
+    for (size_t i = 0; i < COUNTERS; ++i) {
+        descriptors_[i] = OpenCounter(COUNTER_TYPES[i]);
+        if (descriptors_[i] < 0 && error_.empty()) {
+            error_ = std::strerror(errno);
+        }
+    }
+    enabled_ = true;
+}
+
+bool Profiler::IsEnabled() const {
+    return enabled_;
+}
+
+Profiler::Reading Profiler::Read() const {
+    Reading reading{};
+    for (size_t i = 0; i < COUNTERS; ++i) {
+        // the value, the time the counter was enabled and the time it was counting
+        uint64_t values[3] = {};
+        if (descriptors_[i] < 0 || read(descriptors_[i], values, sizeof(values)) != sizeof(values)) {
+            continue;
+        }
+        reading[i] = static_cast<long double>(values[0]);
+        if (values[2] != 0 && values[2] < values[1]) {
+            reading[i] *= static_cast<long double>(values[1]) / static_cast<long double>(values[2]);
+        }
+    }
+    return reading;
+}
+
+void Profiler::Add(Record record) {
+    std::lock_guard lock(mutex_);
+    records_.push_back(std::move(record));
+}
+
+std::string Profiler::GetReport() const {
+    std::array<bool, COUNTERS> available;
+    for (size_t i = 0; i < COUNTERS; ++i) {
+        available[i] = descriptors_[i] >= 0;
+    }
+    bool cycles = available[Index(Counter::CYCLES)];
+    bool instructions = available[Index(Counter::INSTRUCTIONS)];
+    bool misses = available[Index(Counter::CACHE_MISSES)];
+
+    std::ostringstream report;
+    report << std::left << std::setw(40) << "stage" << std::right << std::setw(10) << "pixels" << std::setw(11)
+           << "wall ms" << std::setw(11) << "CPU ms" << std::setw(15) << "cycles" << std::setw(15) << "instructions"
+           << std::setw(7) << "IPC" << std::setw(13) << "LLC misses" << std::setw(10) << "bytes/px" << std::setw(15)
+           << "branch misses" << '\n';
+    std::lock_guard lock(mutex_);
+    for (const Record& record : records_) {
+        const Reading& counts = record.counts;
+        long double ipc = counts[Index(Counter::CYCLES)] == 0
+                              ? 0
+                              : counts[Index(Counter::INSTRUCTIONS)] / counts[Index(Counter::CYCLES)];
+        long double bytes = record.pixels == 0 ? 0
+                                               : counts[Index(Counter::CACHE_MISSES)] * CACHE_LINE /
+                                                     static_cast<long double>(record.pixels);
+        report << std::left << std::setw(40) << record.name << std::right << std::setw(10) << record.pixels
+               << std::setw(11) << Cell(record.milliseconds, true, 3) << std::setw(11)
+               << Cell(counts[Index(Counter::TASK_CLOCK)] / 1e6L, available[Index(Counter::TASK_CLOCK)], 3)
+               << std::setw(15) << Cell(counts[Index(Counter::CYCLES)], cycles) << std::setw(15)
+               << Cell(counts[Index(Counter::INSTRUCTIONS)], instructions) << std::setw(7)
+               << Cell(ipc, cycles && instructions, 2) << std::setw(13)
+               << Cell(counts[Index(Counter::CACHE_MISSES)], misses) << std::setw(10)
+               << Cell(bytes, misses && record.pixels != 0, 2) << std::setw(15)
+               << Cell(counts[Index(Counter::BRANCH_MISSES)], available[Index(Counter::BRANCH_MISSES)]) << '\n';
+    }
+    std::string missing;
+    for (size_t i = 0; i < COUNTERS; ++i) {
+        if (!available[i]) {
+            missing += (missing.empty() ? "" : ", ") + std::string(COUNTER_TYPES[i].name);
+        }
+    }
+    if (!missing.empty()) {
+        report << "not counted: " << missing << " (" << error_ << ")\n";
+    }
+    return report.str();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Counters around the stages of a run, for -perf: the wall and CPU time, cycles, instructions, last level cache misses
+// and branch misses of decoding the input, of every filter and of encoding every output. The counters are opened with
+// perf_event_open on the calling thread and inherited by the threads it starts afterwards, so Enable() must come
+// before the first parallel loop starts the ThreadPool. They count all those threads together, so stages must not
+// overlap. Counters the kernel does not allow or the machine lacks are reported as n/a, and the stages keep their
+// wall time.
+class Profiler {
+public:
+    enum class Counter { TASK_CLOCK, CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES };
+    inline static const size_t COUNTERS = 5;
+    // counts scaled up for the time the kernel multiplexed the counters out, nanoseconds for TASK_CLOCK
+    using Reading = std::array<long double, COUNTERS>;
+
+    // measures from its construction to its destruction if the profiler is enabled, does nothing otherwise
+    class Stage {
+    private:
+        std::string name_;
+        size_t pixels_;
+        bool active_;
+        std::chrono::steady_clock::time_point start_;
+        Reading start_counts_{};
+
+    public:
+        explicit Stage(std::string name, size_t pixels = 0);
+        Stage(const Stage&) = delete;
+        Stage& operator=(const Stage&) = delete;
+        ~Stage();
+
+        // for stages that only learn the size of the image at the end, such as decoding
+        void SetPixels(size_t pixels);
+    };
+
+private:
+    inline static const size_t CACHE_LINE = 64;
+
+    struct Record {
+        std::string name;
+        size_t pixels;
+        long double milliseconds;
+        Reading counts;
+    };
+
+    // -1 for the counters that could not be opened
+    std::array<int, COUNTERS> descriptors_;
+    // why the first counter that could not be opened failed
+    std::string error_;
+    std::atomic<bool> enabled_ = false;
+    mutable std::mutex mutex_;
+    std::vector<Record> records_;
+
+    Profiler();
+    ~Profiler();
+
+    Reading Read() const;
+    void Add(Record record);
+
+public:
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    static Profiler& Instance();
+
+    // opens the counters; stages are only measured after it
+    void Enable();
+    bool IsEnabled() const;
+
+    // a table of the stages in the order they ended, with instructions per cycle and the bytes per pixel the last
+    // level cache misses brought from memory, and the counters that were not available
+    std::string GetReport() const;
+};
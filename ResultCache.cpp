@@ -0,0 +1,106 @@
+#include "ResultCache.h"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <tuple>
+
+#include "Hash.h"
+#include "ImageException.h"
+
+namespace {
+// clones the file, falling back to a copy on file systems without reflinks. Hard links are not used: the next
+// write to the output would truncate the entry with it
+bool Clone(const std::filesystem::path& from, const std::filesystem::path& to) {
+    int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+    int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    bool cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+    if (out >= 0) {
+        close(out);
+    }
+    close(in);
+    if (cloned) {
+        return true;
+    }
+    std::error_code error;
+    return std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, error);
+}
+
+std::string ToHex(uint64_t value) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(value));
+    return text;
+}
+}  // namespace
+
+ResultCache::ResultCache(std::filesystem::path directory, uintmax_t max_size)
+    : directory_(std::move(directory)), max_size_(max_size) {
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    if (!std::filesystem::is_directory(directory_, error)) {
+        throw OpenFileError(directory_.c_str());
+    }
+}
+
+std::string ResultCache::GetKey(const std::vector<unsigned char>& input, const std::string& filters) {
+    return ToHex(Hash64(input.data(), input.size())) + ToHex(Hash64(filters.data(), filters.size())) + ".bmp";
+}
+
+bool ResultCache::Fetch(const std::string& key, const std::filesystem::path& path) const {
+    std::filesystem::path entry = directory_ / key;
+    if (!Clone(entry, path)) {
+        return false;
+    }
+    std::error_code error;
+    std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), error);
+    return true;
+}
+
+void ResultCache::Store(const std::string& key, const std::filesystem::path& path) const {
+    static std::atomic<uint64_t> stored = 0;
+    // entries appear whole to other processes
+    std::filesystem::path temporary =
+        directory_ / (key + "." + std::to_string(getpid()) + "." + std::to_string(stored++) + ".tmp");
+    std::error_code error;
+    if (Clone(path, temporary)) {
+        std::filesystem::rename(temporary, directory_ / key, error);
+    }
+    std::filesystem::remove(temporary, error);
+    Evict();
+}
+
+void ResultCache::Evict() const {
+    std::vector<std::tuple<std::filesystem::file_time_type, uintmax_t, std::filesystem::path>> entries;
+    uintmax_t total = 0;
+    std::error_code error;
+    for (const auto& file : std::filesystem::directory_iterator(directory_, error)) {
+        if (!file.is_regular_file(error) || file.path().extension() == ".tmp") {
+            continue;
+        }
+        uintmax_t size = file.file_size(error);
+        auto time = file.last_write_time(error);
+        if (!error) {
+            entries.emplace_back(time, size, file.path());
+            total += size;
+        }
+    }
+    if (total <= max_size_) {
+        return;
+    }
+    std::sort(entries.begin(), entries.end());
+    for (const auto& [time, size, path] : entries) {
+        if (total <= max_size_) {
+            break;
+        }
+        std::filesystem::remove(path, error);
+        total -= size;
+    }
+}
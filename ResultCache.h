@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Output files kept in a directory under keys made of the hash of the input file and of the keys of the filters
+// that made them, so that applying the same filters to the same file again only copies the output. Entries are
+// files named by their key, used entries are touched, and the least recently used ones are removed once the
+// directory grows beyond its size limit. Any number of processes may share the directory.
+class ResultCache {
+private:
+    std::filesystem::path directory_;
+    uintmax_t max_size_;
+
+    // removes the least recently used entries until the directory fits in max_size_
+    void Evict() const;
+
+public:
+    inline static const uintmax_t DEFAULT_MAX_SIZE = uintmax_t{1} << 30;
+
+    explicit ResultCache(std::filesystem::path directory, uintmax_t max_size = DEFAULT_MAX_SIZE);
+
+    // key of the output of filters with the given key applied to an input file with the given contents
+    static std::string GetKey(const std::vector<unsigned char>& input, const std::string& filters);
+
+    // puts the entry at path, sharing its blocks where the file system can clone files; false on a miss
+    bool Fetch(const std::string& key, const std::filesystem::path& path) const;
+
+    // adds the file at path as the entry; the cache is only an optimization, so failures are ignored
+    void Store(const std::string& key, const std::filesystem::path& path) const;
+};
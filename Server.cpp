@@ -0,0 +1,390 @@
+#include "Server.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include "BMPio.h"
+#include "ImageException.h"
+#include "ImageRedactor.h"
+#include "Parallel.h"
+
+namespace {
+// larger strings are taken for a broken message: a 24-bit BMP of 8192 x 8192 pixels takes 192 MiB
+const uint32_t MAX_STRING_SIZE = 1u << 28;
+// strings grow by this much as their bytes arrive, so that a header alone does not allocate its size
+const uint32_t RECEIVE_STEP = 1u << 20;
+const uint32_t MAX_STRINGS = 1u << 16;
+const int BACKLOG = 64;
+
+// false if the connection was closed before any byte was read
+bool ReceiveBytes(int connection, char* data, size_t size) {
+    size_t received = 0;
+    while (received < size) {
+        ssize_t count = recv(connection, data + received, size - received, 0);
+        if (count == 0 && received == 0) {
+            return false;
+        }
+        if (count <= 0) {
+            throw SocketError();
+        }
+        received += count;
+    }
+    return true;
+}
+
+void SendBytes(int connection, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t count = send(connection, data, size, MSG_NOSIGNAL);
+        if (count <= 0) {
+            throw SocketError();
+        }
+        data += count;
+        size -= count;
+    }
+}
+
+uint32_t DecodeSize(const unsigned char* bytes) {
+    uint32_t size = 0;
+    for (size_t i = 0; i < sizeof(uint32_t); ++i) {
+        size |= static_cast<uint32_t>(bytes[i]) << (8 * i);
+    }
+    return size;
+}
+
+bool ReceiveSize(int connection, uint32_t& size) {
+    unsigned char bytes[sizeof(uint32_t)];
+    if (!ReceiveBytes(connection, reinterpret_cast<char*>(bytes), sizeof(bytes))) {
+        return false;
+    }
+    size = DecodeSize(bytes);
+    return true;
+}
+
+// takes a whole message off the front of the bytes received so far; false if it has not all arrived yet
+bool TakeMessage(std::string& data, ServerMessage& message) {
+    size_t offset = 0;
+    auto take_size = [&data, &offset](uint32_t& size) {
+        if (data.size() - offset < sizeof(uint32_t)) {
+            return false;
+        }
+        size = DecodeSize(reinterpret_cast<const unsigned char*>(data.data() + offset));
+        offset += sizeof(uint32_t);
+        return true;
+    };
+    uint32_t count = 0;
+    if (!take_size(count)) {
+        return false;
+    }
+    if (count > MAX_STRINGS) {
+        throw SocketError();
+    }
+    std::vector<std::pair<size_t, size_t>> strings;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t size = 0;
+        if (!take_size(size)) {
+            return false;
+        }
+        if (size > MAX_STRING_SIZE) {
+            throw SocketError();
+        }
+        if (data.size() - offset < size) {
+            return false;
+        }
+        strings.emplace_back(offset, size);
+        offset += size;
+    }
+    message.clear();
+    for (auto [begin, size] : strings) {
+        message.emplace_back(data, begin, size);
+    }
+    data.erase(0, offset);
+    return true;
+}
+
+void SendSize(int connection, uint32_t size) {
+    unsigned char bytes[sizeof(uint32_t)];
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+        bytes[i] = static_cast<unsigned char>(size >> (8 * i));
+    }
+    SendBytes(connection, reinterpret_cast<char*>(bytes), sizeof(bytes));
+}
+
+sockaddr_un GetAddress(const std::string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw SocketError(path.c_str());
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+double Milliseconds(std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+}  // namespace
+
+bool ReceiveMessage(int connection, ServerMessage& message) {
+    uint32_t count = 0;
+    if (!ReceiveSize(connection, count)) {
+        return false;
+    }
+    if (count > MAX_STRINGS) {
+        throw SocketError();
+    }
+    message.assign(count, std::string());
+    for (auto& string : message) {
+        uint32_t size = 0;
+        if (!ReceiveSize(connection, size) || size > MAX_STRING_SIZE) {
+            throw SocketError();
+        }
+        while (string.size() < size) {
+            size_t received = string.size();
+            string.resize(received + std::min(size - received, size_t{RECEIVE_STEP}));
+            if (!ReceiveBytes(connection, string.data() + received, string.size() - received)) {
+                throw SocketError();
+            }
+        }
+    }
+    return true;
+}
+
+void SendMessage(int connection, const ServerMessage& message) {
+    SendSize(connection, static_cast<uint32_t>(message.size()));
+    for (const auto& string : message) {
+        SendSize(connection, static_cast<uint32_t>(string.size()));
+        SendBytes(connection, string.data(), string.size());
+    }
+}
+
+Server::Server(const std::string& path) : path_(path) {
+    sockaddr_un address = GetAddress(path_);
+    struct stat status {};
+    if (lstat(path_.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(path_.c_str());
+    }
+    socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_ < 0 || bind(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(socket_, BACKLOG) != 0 || pipe2(wake_, O_NONBLOCK | O_CLOEXEC) != 0) {
+        if (socket_ >= 0) {
+            close(socket_);
+        }
+        throw SocketError(path_.c_str());
+    }
+}
+
+Server::~Server() {
+    close(socket_);
+    close(wake_[0]);
+    close(wake_[1]);
+    unlink(path_.c_str());
+}
+
+void Server::Run() {
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < GetThreadCount(); ++i) {
+        workers.emplace_back(&Server::Work, this);
+    }
+    // the socket, the wake pipe, then the connections waiting for a request
+    std::vector<pollfd> polled = {{socket_, POLLIN, 0}, {wake_[0], POLLIN, 0}};
+    // the bytes received on every open connection that do not make a whole request yet
+    std::map<int, std::string> received;
+    // hands the next request of the connection to the workers, if it has all arrived; false if it has not
+    auto dispatch = [this, &received](int connection) {
+        ServerMessage request;
+        if (!TakeMessage(received[connection], request)) {
+            return false;
+        }
+        {
+            std::lock_guard lock(mutex_);
+            jobs_.push_back({connection, std::move(request)});
+        }
+        ready_.notify_one();
+        return true;
+    };
+    while (true) {
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            continue;
+        }
+        size_t ready = polled.size();
+        if (polled[1].revents != 0) {
+            char bytes[64];
+            while (read(wake_[0], bytes, sizeof(bytes)) > 0) {
+            }
+            std::vector<int> answered;
+            {
+                std::lock_guard lock(mutex_);
+                answered.swap(answered_);
+            }
+            // clients may send their next request before the reply to the last one
+            for (int connection : answered) {
+                if (!dispatch(connection)) {
+                    polled.push_back({connection, POLLIN, 0});
+                }
+            }
+        }
+        if (polled[0].revents != 0) {
+            int connection = accept(socket_, nullptr, nullptr);
+            if (connection >= 0) {
+                // a client that does not take its reply only holds its worker for a while
+                timeval timeout{SEND_TIMEOUT_SECONDS, 0};
+                setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                polled.push_back({connection, POLLIN, 0});
+            }
+        }
+        // the connections added above were not polled yet
+        for (size_t i = 2; i < ready;) {
+            if (polled[i].revents == 0) {
+                ++i;
+                continue;
+            }
+            int connection = polled[i].fd;
+            bool done = false;
+            try {
+                char chunk[RECEIVE_CHUNK];
+                ssize_t count = recv(connection, chunk, sizeof(chunk), MSG_DONTWAIT);
+                if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    throw SocketError();
+                }
+                if (count > 0) {
+                    received[connection].append(chunk, count);
+                }
+                // polled again once answered
+                done = dispatch(connection);
+            } catch (const SocketError& e) {
+                // closed by the client, or a broken request
+                received.erase(connection);
+                close(connection);
+                done = true;
+            }
+            if (!done) {
+                ++i;
+                continue;
+            }
+            polled[i] = polled[ready - 1];
+            polled[ready - 1] = polled.back();
+            polled.pop_back();
+            --ready;
+        }
+    }
+}
+
+void Server::Work() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock lock(mutex_);
+            ready_.wait(lock, [this]() { return !jobs_.empty(); });
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        try {
+            SendMessage(job.connection, Process(job.request));
+        } catch (const std::exception& e) {
+            // the client went away, or did not take the reply; Run() sees the connection closed
+            shutdown(job.connection, SHUT_RDWR);
+        }
+        {
+            std::lock_guard lock(mutex_);
+            answered_.push_back(job.connection);
+        }
+        char byte = 0;
+        // a full pipe already wakes Run() up
+        [[maybe_unused]] ssize_t written = write(wake_[1], &byte, 1);
+    }
+}
+
+ServerMessage Server::Process(const ServerMessage& request) const {
+    ServerMessage reply(3);
+    try {
+        if (request.size() < 3) {
+            throw NoOutput();
+        }
+        const std::string& input = request[0];
+        const std::string& output = request[1];
+        std::vector<std::string> options(request.begin() + 3, request.end());
+        std::vector<char*> argv;
+        for (auto& option : options) {
+            argv.push_back(option.data());
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        Image image;
+        ImageRedactor redactor(image);
+        redactor.Parse(argv.size(), argv.data());
+        if (const char* option = redactor.GetUnservedOption(); option != nullptr) {
+            throw UnsupportedOption(option);
+        }
+        redactor.LoadAuxiliary();
+        if (input.empty()) {
+            ReadBMP()(reinterpret_cast<const unsigned char*>(request[2].data()), request[2].size(), image);
+        } else {
+            ReadBMP(input.c_str(), image);
+        }
+        auto decoded = std::chrono::steady_clock::now();
+        redactor.Execute();
+        redactor.WriteStatistics(image);
+        auto filtered = std::chrono::steady_clock::now();
+        if (output.empty()) {
+            std::vector<unsigned char> data;
+            WriteBMP()(image, data, redactor.GetBitsPerPixel());
+            reply[2].assign(data.begin(), data.end());
+        } else {
+            WriteBMP(output.c_str(), image, redactor.GetBitsPerPixel());
+        }
+        auto encoded = std::chrono::steady_clock::now();
+
+        std::ostringstream timings;
+        timings << std::fixed << std::setprecision(3) << "decode " << Milliseconds(start, decoded) << " ms, filters "
+                << Milliseconds(decoded, filtered) << " ms, encode " << Milliseconds(filtered, encoded) << " ms";
+        reply[0] = "OK";
+        reply[1] = timings.str();
+    } catch (const ImageException& e) {
+        reply[0] = e.what();
+    } catch (const std::exception& e) {
+        reply[0] = std::string("Somewhere, something went terribly wrong: ") + e.what();
+    }
+    return reply;
+}
+
+Client::Client(const std::string& path) : path_(path) {
+    sockaddr_un address = GetAddress(path_);
+    socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_ < 0 || connect(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        if (socket_ >= 0) {
+            close(socket_);
+        }
+        throw SocketError(path_.c_str());
+    }
+}
+
+Client::~Client() {
+    close(socket_);
+}
+
+ServerMessage Client::Send(const ServerMessage& request) {
+    try {
+        SendMessage(socket_, request);
+        ServerMessage reply;
+        if (!ReceiveMessage(socket_, reply)) {
+            throw SocketError();
+        }
+        return reply;
+    } catch (SocketError& e) {
+        e.SetFile(path_.c_str());
+        throw e;
+    }
+}
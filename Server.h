@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Requests and replies are lists of byte strings, sent as a 32-bit little-endian count followed by every string as a
+// 32-bit little-endian length and its bytes. A connection may carry any number of requests, each answered in turn.
+//   request: input path (empty if the file is sent), output path (empty to get the file back), the input file or
+//            nothing, then the options of the chain as on the command line
+//   reply:   "OK" or the error message, the time spent on every stage, the output file or nothing
+using ServerMessage = std::vector<std::string>;
+
+// false if the connection was closed before a message started
+bool ReceiveMessage(int connection, ServerMessage& message);
+
+void SendMessage(int connection, const ServerMessage& message);
+
+// Keeps a process with its threads, allocator and caches warm and processes requests sent to a Unix domain socket.
+// Run() polls the open connections and gathers the bytes of their requests as they arrive; each whole request goes
+// to the first free of GetThreadCount() workers, which answers it and gives the connection back. Idle clients and
+// clients slow to send hold no worker.
+class Server {
+private:
+    // how long a worker waits for a client to take its reply
+    inline static const int SEND_TIMEOUT_SECONDS = 10;
+    inline static const size_t RECEIVE_CHUNK = 1 << 16;
+    struct Job {
+        int connection;
+        ServerMessage request;
+    };
+    std::string path_;
+    int socket_ = -1;
+    // written by the workers to wake Run() up when they give connections back
+    int wake_[2] = {-1, -1};
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<Job> jobs_;
+    // connections answered, for Run() to poll again
+    std::vector<int> answered_;
+
+    void Work();
+    ServerMessage Process(const ServerMessage& request) const;
+
+public:
+    // binds the socket, replacing a stale one left at the path
+    explicit Server(const std::string& path);
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+    ~Server();
+
+    // accepts connections until the process is stopped
+    void Run();
+};
+
+class Client {
+private:
+    std::string path_;
+    int socket_ = -1;
+
+public:
+    explicit Client(const std::string& path);
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+    ~Client();
+
+    ServerMessage Send(const ServerMessage& request);
+};
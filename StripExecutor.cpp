@@ -0,0 +1,91 @@
+#include "StripExecutor.h"
+
+#include <utility>
+
+#include "TiledExecutor.h"
+
+namespace {
+// runs the chain on a window, tile by tile when that pays off
+void RunChain(const std::vector<const Filter*>& filters, Image& window) {
+    TiledExecutor tiled;
+    if (tiled.Accepts(filters, window)) {
+        tiled(filters, window);
+        return;
+    }
+    for (const Filter* filter : filters) {
+        RunFilter(*filter, window);
+    }
+}
+}  // namespace
+
+size_t StripExecutor::GetWindowMemory(const std::vector<const Filter*>& filters, size_t height, size_t width,
+                                      Image::Format format) const {
+    size_t halo = TiledExecutor::GetFootprint(filters, height, width);
+    size_t rows = std::min(height, strip_rows_ + 2 * std::min(halo, height));
+    size_t peak = Image::GetBytes(rows, width, format);
+    for (const Filter* filter : filters) {
+        peak = std::max(peak, Image::GetBytes(rows, width, format) + filter->GetWorkspace(rows, width, format));
+        format = filter->GetFormat(format);
+    }
+    // tiles are pasted into a result beside the window
+    if (TiledExecutor().Accepts(filters, rows, width)) {
+        peak += Image::GetBytes(rows, width, format);
+    }
+    return peak;
+}
+
+void StripExecutor::operator()(const std::vector<const Filter*>& filters, size_t height, size_t width,
+                               const Source& source, const Sink& sink) const {
+    size_t halo = std::min(TiledExecutor::GetFootprint(filters, height, width), height);
+    for (size_t x = 0; x < height; x += strip_rows_) {
+        size_t rows = std::min(strip_rows_, height - x);
+        size_t top = x - std::min(x, halo);
+        size_t bottom = std::min(height, x + rows + halo);
+        Image window = source(top, bottom - top);
+        Image::GrayGrid alpha = window.ReleaseAlpha();
+        RunChain(filters, window);
+        window.SetAlpha(std::move(alpha));
+        sink(window, x - top, x, rows);
+    }
+}
+
+void StripExecutor::operator()(const std::vector<const Filter*>& filters, Image& image) const {
+    size_t height = image.GetHeight();
+    size_t width = image.GetWidth();
+    if (height == 0 || width == 0) {
+        RunChain(filters, image);
+        return;
+    }
+    auto [origin_x, origin_y] = image.GetOrigin();
+    auto [frame_height, frame_width] = image.GetFrameSize();
+    bool whole = origin_x == 0 && origin_y == 0 && frame_height == height && frame_width == width;
+    Image::GrayGrid alpha = image.ReleaseAlpha();
+
+    // rows [offset, height) of the image, the ones the strips still read
+    Image rest = std::move(image);
+    size_t offset = 0;
+    Image result;
+    Source source = [&](size_t x, size_t rows) {
+        if (x > offset) {
+            // the rows above are dropped without copying the ones below
+            rest = rest.SplitRows(x - offset);
+            offset = x;
+        }
+        return rest.Window(x - offset, 0, rows, width);
+    };
+    Sink append = [&](Image& window, size_t source_x, size_t x, size_t rows) {
+        Image kept = window.SplitRows(source_x);
+        kept.SplitRows(rows);
+        result.AppendRows(std::move(kept));
+    };
+    operator()(filters, height, width, source, append);
+
+    // a whole image stays a frame of its own, which filters changing its size keep it
+    if (whole) {
+        result.SetFrame(0, 0, 0, 0);
+    } else {
+        result.SetFrame(origin_x, origin_y, frame_height, frame_width);
+    }
+    result.SetAlpha(std::move(alpha));
+    image = std::move(result);
+}
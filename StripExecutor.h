@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "Filter.h"
+#include "Image.h"
+
+// Runs a chain of filters with finite footprints over a frame a strip of rows at a time. Every strip is filtered as a
+// window extended by the footprint of the chain above and below it, which gives its rows as the whole frame would,
+// so what the filters allocate is sized by the window instead of the frame. The frame is either read and written a
+// strip at a time, and never held whole, or held in memory, where the result takes the place of the rows no later
+// strip reads.
+class StripExecutor {
+public:
+    // gives rows [x, x + height) of the frame, with their alpha, as a window of it
+    using Source = std::function<Image(size_t x, size_t height)>;
+    // takes a filtered window, whose rows [source_x, source_x + height) are rows [x, x + height) of the frame
+    using Sink = std::function<void(Image& window, size_t source_x, size_t x, size_t height)>;
+
+private:
+    size_t strip_rows_;
+
+public:
+    explicit StripExecutor(size_t strip_rows) : strip_rows_(std::max<size_t>(strip_rows, 1)){};
+
+    size_t GetStripRows() const {
+        return strip_rows_;
+    }
+
+    // the most bytes a window of a frame of the given size and format takes while the chain runs on it, with what
+    // the filters allocate beside it; the alpha plane is left out
+    size_t GetWindowMemory(const std::vector<const Filter*>& filters, size_t height, size_t width,
+                           Image::Format format) const;
+
+    // filters a frame of the given size, reading the windows from source and passing them on to sink strip by
+    // strip, from the top
+    void operator()(const std::vector<const Filter*>& filters, size_t height, size_t width, const Source& source,
+                    const Sink& sink) const;
+
+    // filters an image in memory, which holds little more than the larger of the image and the result at once
+    void operator()(const std::vector<const Filter*>& filters, Image& image) const;
+};
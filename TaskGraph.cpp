@@ -0,0 +1,62 @@
+#include "TaskGraph.h"
+
+TaskGraph::Task TaskGraph::Add(std::function<void()> body, const std::vector<Task>& after) {
+    Task task = nodes_.size();
+    Node& node = nodes_.emplace_back();
+    node.body = std::move(body);
+    node.dependencies = after.size();
+    for (Task dependency : after) {
+        nodes_[dependency].successors.push_back(task);
+    }
+    return task;
+}
+
+void TaskGraph::Schedule(ThreadPool& pool, Task task) {
+    pool.Submit([this, &pool, task]() {
+        Node& node = nodes_[task];
+        bool failed = false;
+        {
+            std::lock_guard lock(error_mutex_);
+            failed = static_cast<bool>(error_);
+        }
+        if (!failed) {
+            try {
+                node.body();
+            } catch (...) {
+                std::lock_guard lock(error_mutex_);
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+            }
+        }
+        for (Task successor : node.successors) {
+            if (--nodes_[successor].remaining == 0) {
+                Schedule(pool, successor);
+            }
+        }
+        // the graph may be gone once the last task is counted
+        if (--unfinished_ == 0) {
+            pool.Notify();
+        }
+    });
+}
+
+void TaskGraph::Run() {
+    if (nodes_.empty()) {
+        return;
+    }
+    ThreadPool& pool = ThreadPool::Instance();
+    unfinished_ = nodes_.size();
+    for (Node& node : nodes_) {
+        node.remaining = node.dependencies;
+    }
+    for (Task task = 0; task < nodes_.size(); ++task) {
+        if (nodes_[task].dependencies == 0) {
+            Schedule(pool, task);
+        }
+    }
+    pool.RunUntil([this]() { return unfinished_ == 0; });
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
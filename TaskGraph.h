@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Tasks with dependencies between them, run on the shared ThreadPool. A task is started as soon as the tasks it
+// depends on have finished, so independent branches and the later stages of finished parts overlap.
+class TaskGraph {
+public:
+    using Task = size_t;
+
+private:
+    struct Node {
+        std::function<void()> body;
+        std::vector<Task> successors;
+        size_t dependencies = 0;
+        std::atomic<size_t> remaining = 0;
+    };
+
+    // a deque keeps the nodes in place while they are added
+    std::deque<Node> nodes_;
+    std::atomic<size_t> unfinished_ = 0;
+    std::exception_ptr error_;
+    std::mutex error_mutex_;
+
+    void Schedule(ThreadPool& pool, Task task);
+
+public:
+    // adds a task that starts after the given ones
+    Task Add(std::function<void()> body, const std::vector<Task>& after = {});
+
+    // runs all the tasks and waits for them, helping the pool meanwhile; once a task throws, the tasks that have not
+    // started are skipped and the exception is rethrown
+    void Run();
+};
@@ -0,0 +1,109 @@
+#include "ThreadPool.h"
+
+#include "Parallel.h"
+
+namespace {
+// pool and queue index of the workers, to tell them from the other threads
+thread_local const ThreadPool* worker_pool = nullptr;
+thread_local size_t worker_index = 0;
+}  // namespace
+
+ThreadPool::ThreadPool(size_t workers) {
+    for (size_t i = 0; i < workers + 1; ++i) {
+        queues_.emplace_back(std::make_unique<Queue>());
+    }
+    workers_.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        workers_.emplace_back(&ThreadPool::Work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::Instance() {
+    static ThreadPool pool(GetThreadCount() - 1);
+    return pool;
+}
+
+size_t ThreadPool::GetHome() const {
+    return (worker_pool == this) ? worker_index : workers_.size();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    Queue& queue = *queues_[GetHome()];
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard lock(sleep_mutex_);
+        ++queued_;
+    }
+    wake_.notify_all();
+}
+
+bool ThreadPool::TryRun(size_t home) {
+    std::function<void()> task;
+    for (size_t i = 0; i < queues_.size() && !task; ++i) {
+        Queue& queue = *queues_[(home + i) % queues_.size()];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    --queued_;
+    task();
+    return true;
+}
+
+void ThreadPool::Work(size_t index) {
+    worker_pool = this;
+    worker_index = index;
+    while (true) {
+        if (TryRun(index)) {
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex_);
+        wake_.wait(lock, [this]() { return stopping_ || queued_ > 0; });
+        if (stopping_) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::RunUntil(const std::function<bool()>& done) {
+    size_t home = GetHome();
+    while (!done()) {
+        if (TryRun(home)) {
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex_);
+        wake_.wait(lock, [this, &done]() { return queued_ > 0 || done(); });
+    }
+}
+
+void ThreadPool::Notify() {
+    {
+        std::lock_guard lock(sleep_mutex_);
+    }
+    wake_.notify_all();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool shared by the whole process. Every worker has its own queue: it takes the tasks it submitted
+// last first, and when its queue is empty it steals the oldest tasks of the others. Threads waiting for their
+// tasks run queued ones meanwhile, so tasks may wait for tasks they submit.
+class ThreadPool {
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // one queue per worker and one for the other threads
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    // may drop below zero for a moment, when a task is taken before its submission is counted
+    std::atomic<ptrdiff_t> queued_ = 0;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+
+    // index of the queue of the calling thread
+    size_t GetHome() const;
+    bool TryRun(size_t home);
+    void Work(size_t index);
+
+public:
+    // the calling threads help the workers, so a pool of one thread has no workers at all
+    explicit ThreadPool(size_t workers);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    // the pool with GetThreadCount() - 1 workers
+    static ThreadPool& Instance();
+
+    void Submit(std::function<void()> task);
+
+    // runs queued tasks on the calling thread until done() returns true; done() is checked again after Notify()
+    void RunUntil(const std::function<bool()>& done);
+
+    // wakes the threads in RunUntil after the state their done() checks has changed
+    void Notify();
+};
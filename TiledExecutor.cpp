@@ -0,0 +1,114 @@
+#include "TiledExecutor.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include "Parallel.h"
+#include "TaskGraph.h"
+#include "Tuning.h"
+
+size_t TiledExecutor::GetTunedTileSize() {
+    size_t tuned = Tuning::Get().tile_size;
+    return tuned != 0 ? tuned : DEFAULT_TILE_SIZE;
+}
+
+size_t TiledExecutor::GetFootprint(const std::vector<const Filter*>& filters, size_t height, size_t width) {
+    size_t footprint = 0;
+    for (const Filter* filter : filters) {
+        size_t own = filter->GetFootprint(height, width);
+        if (own == Filter::FULL_FRAME || own > Filter::FULL_FRAME - footprint) {
+            return Filter::FULL_FRAME;
+        }
+        footprint += own;
+    }
+    return footprint;
+}
+
+bool TiledExecutor::Accepts(const std::vector<const Filter*>& filters, const Image& image) const {
+    return Accepts(filters, image.GetHeight(), image.GetWidth());
+}
+
+bool TiledExecutor::Accepts(const std::vector<const Filter*>& filters, size_t height, size_t width) const {
+    // tiles pay off by running filters that work on one thread side by side; a single thread only pays for copying
+    // them in and out
+    if (filters.size() < 2 || tile_size_ == 0 || GetThreadCount() < 2) {
+        return false;
+    }
+    if (height <= tile_size_ && width <= tile_size_) {
+        return false;
+    }
+    // recomputing the halos adds at most about a quarter to the work
+    size_t footprint = GetFootprint(filters, height, width);
+    return footprint != Filter::FULL_FRAME && HALO_RATIO * footprint <= tile_size_;
+}
+
+size_t TiledExecutor::GetTileRows(const Image& image) const {
+    return (image.GetHeight() + tile_size_ - 1) / tile_size_;
+}
+
+size_t TiledExecutor::GetTileColumns(const Image& image) const {
+    return (image.GetWidth() + tile_size_ - 1) / tile_size_;
+}
+
+void TiledExecutor::RunTile(const std::vector<const Filter*>& filters, const Image& image, size_t tile, size_t halo,
+                            const Sink& sink) const {
+    size_t height = image.GetHeight();
+    size_t width = image.GetWidth();
+    size_t tile_columns = GetTileColumns(image);
+    size_t x = tile / tile_columns * tile_size_;
+    size_t y = tile % tile_columns * tile_size_;
+    size_t tile_height = std::min(tile_size_, height - x);
+    size_t tile_width = std::min(tile_size_, width - y);
+    size_t window_x = x - std::min(x, halo);
+    size_t window_y = y - std::min(y, halo);
+    size_t window_height = std::min(height, x + tile_height + halo) - window_x;
+    size_t window_width = std::min(width, y + tile_width + halo) - window_y;
+
+    Image window = image.Window(window_x, window_y, window_height, window_width);
+    for (const Filter* filter : filters) {
+        RunFilter(*filter, window);
+    }
+    sink(window, x - window_x, y - window_y, x, y, tile_height, tile_width);
+}
+
+void TiledExecutor::operator()(const std::vector<const Filter*>& filters, Image& image) const {
+    size_t height = image.GetHeight();
+    size_t width = image.GetWidth();
+    size_t halo = GetFootprint(filters, height, width);
+    auto [hor_res, ver_res] = image.GetRes();
+
+    // the format of the result is only known once a tile has gone through the chain
+    Image result;
+    std::once_flag allocated;
+    Sink paste = [&](Image& window, size_t source_x, size_t source_y, size_t x, size_t y, size_t tile_height,
+                     size_t tile_width) {
+        std::call_once(allocated, [&]() {
+            if (window.IsGray()) {
+                result = Image(Image::GrayGrid(height, std::vector<long double>(width)), hor_res, ver_res);
+            } else {
+                result = Image(std::vector<std::vector<Image::Pixel>>(height, std::vector<Image::Pixel>(width)),
+                               hor_res, ver_res);
+            }
+        });
+        // tiles write disjoint parts of the rows
+        result.Paste(window, source_x, source_y, x, y, tile_height, tile_width);
+    };
+    TaskGraph graph;
+    for (size_t tile = 0; tile < GetTileRows(image) * GetTileColumns(image); ++tile) {
+        graph.Add([&, tile]() { RunTile(filters, image, tile, halo, paste); });
+    }
+    graph.Run();
+    result.SetMasks(image.GetMasks());
+    result.SetAlpha(image.ReleaseAlpha());
+    image = std::move(result);
+}
+
+void TiledExecutor::operator()(const std::vector<const Filter*>& filters, const Image& image,
+                               const std::vector<size_t>& tiles, const Sink& sink) const {
+    size_t halo = GetFootprint(filters, image.GetHeight(), image.GetWidth());
+    TaskGraph graph;
+    for (size_t tile : tiles) {
+        graph.Add([&, tile]() { RunTile(filters, image, tile, halo, sink); });
+    }
+    graph.Run();
+}
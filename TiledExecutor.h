@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "Filter.h"
+#include "Image.h"
+
+// Runs a chain of filters with finite footprints tile by tile, so that every filter of the chain works on a tile
+// while it is still in cache instead of streaming the whole image once per filter. Each tile is extended by the
+// footprints of the whole chain, which makes the result the same as applying the filters to the whole image.
+class TiledExecutor {
+public:
+    // called with a tile that went through the chain, still extended by its halo, and the part of it to keep: the
+    // area of height and width at (source_x, source_y), which lies at (x, y) in the image
+    using Sink = std::function<void(Image& window, size_t source_x, size_t source_y, size_t x, size_t y,
+                                    size_t height, size_t width)>;
+
+private:
+    // tiles are at least this many times as wide as the halo around them
+    inline static const size_t HALO_RATIO = 16;
+    size_t tile_size_;
+
+    void RunTile(const std::vector<const Filter*>& filters, const Image& image, size_t tile, size_t halo,
+                 const Sink& sink) const;
+
+public:
+    inline static const size_t DEFAULT_TILE_SIZE = 128;
+
+    // the tile size --tune picked, DEFAULT_TILE_SIZE without one
+    static size_t GetTunedTileSize();
+
+    explicit TiledExecutor(size_t tile_size = GetTunedTileSize()) : tile_size_(tile_size){};
+
+    // sum of the footprints of the filters, Filter::FULL_FRAME if one of them needs the whole frame
+    static size_t GetFootprint(const std::vector<const Filter*>& filters, size_t height, size_t width);
+
+    // whether tiling the image pays off: the chain has several filters, there are several threads and a tile is much
+    // larger than its halo
+    bool Accepts(const std::vector<const Filter*>& filters, const Image& image) const;
+
+    // the same for an image of the given size
+    bool Accepts(const std::vector<const Filter*>& filters, size_t height, size_t width) const;
+
+    size_t GetTileSize() const {
+        return tile_size_;
+    }
+
+    // tiles are numbered row by row
+    size_t GetTileRows(const Image& image) const;
+
+    size_t GetTileColumns(const Image& image) const;
+
+    void operator()(const std::vector<const Filter*>& filters, Image& image) const;
+
+    // applies the chain to the given tiles of the image only, passing each of them to sink
+    void operator()(const std::vector<const Filter*>& filters, const Image& image, const std::vector<size_t>& tiles,
+                    const Sink& sink) const;
+};
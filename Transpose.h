@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+
+// side of the blocks copied cell by cell: 16 x 16 pixels of the source and of the target stay in the first level
+// cache together
+inline const size_t TRANSPOSE_BLOCK = 16;
+
+// calls copy(x, y) for every cell of rows [x_begin, x_end) and columns [y_begin, y_end) in the order of a
+// cache-oblivious transpose: the longer side is halved until the block is small, so that whatever the size of the
+// caches, the rows of the block in the source and its columns in the target stay in them while it is copied. copy
+// moves the cell (x, y) of one grid to (y, x) of another, possibly with offsets or reversed rows
+template <typename F>
+void TransposeBlocks(size_t x_begin, size_t x_end, size_t y_begin, size_t y_end, const F& copy) {
+    size_t height = x_end - x_begin;
+    size_t width = y_end - y_begin;
+    if (height <= TRANSPOSE_BLOCK && width <= TRANSPOSE_BLOCK) {
+        for (size_t x = x_begin; x < x_end; ++x) {
+            for (size_t y = y_begin; y < y_end; ++y) {
+                copy(x, y);
+            }
+        }
+    } else if (height >= width) {
+        TransposeBlocks(x_begin, x_begin + height / 2, y_begin, y_end, copy);
+        TransposeBlocks(x_begin + height / 2, x_end, y_begin, y_end, copy);
+    } else {
+        TransposeBlocks(x_begin, x_end, y_begin, y_begin + width / 2, copy);
+        TransposeBlocks(x_begin, x_end, y_begin + width / 2, y_end, copy);
+    }
+}
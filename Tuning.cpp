@@ -0,0 +1,89 @@
+#include "Tuning.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <thread>
+
+#include "ImageException.h"
+
+namespace {
+Tuning& Current() {
+    static Tuning tuning;
+    return tuning;
+}
+}  // namespace
+
+const Tuning& Tuning::Get() {
+    return Current();
+}
+
+void Tuning::Set(const Tuning& tuning) {
+    Current() = tuning;
+}
+
+std::filesystem::path Tuning::GetDefaultPath() {
+    if (const char* path = std::getenv("IMAGE_PROCESSOR_TUNING"); path != nullptr && *path != '\0') {
+        return path;
+    }
+    const char* home = std::getenv("HOME");
+    return std::filesystem::path(home != nullptr ? home : ".") / ".cache" / "image_processor.tuning";
+}
+
+bool Tuning::Load(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    Tuning tuning;
+    size_t hardware_threads = 0;
+    std::string name;
+    while (file >> name) {
+        if (name == "hardware_threads") {
+            file >> hardware_threads;
+        } else if (name == "threads") {
+            file >> tuning.threads;
+        } else if (name == "band_grain") {
+            file >> tuning.band_grain;
+        } else if (name == "tile_size") {
+            file >> tuning.tile_size;
+        } else if (name == "io_block_size") {
+            file >> tuning.io_block_size;
+        } else if (name == "speed") {
+            file >> tuning.speed;
+        } else {
+            // comments and the parameters of other versions
+            std::getline(file, name);
+        }
+        if (file.fail()) {
+            return false;
+        }
+    }
+    if (hardware_threads != std::thread::hardware_concurrency() || tuning.speed <= 0) {
+        return false;
+    }
+    Set(tuning);
+    return true;
+}
+
+void Tuning::Save(const std::filesystem::path& path) const {
+    std::error_code error;
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path(), error);
+    }
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) {
+        throw OpenFileError(path.c_str());
+    }
+    file << "# written by image_processor --tune\n";
+    file << "hardware_threads " << std::thread::hardware_concurrency() << '\n';
+    file << "threads " << threads << '\n';
+    file << "band_grain " << band_grain << '\n';
+    file << "tile_size " << tile_size << '\n';
+    file << "io_block_size " << io_block_size << '\n';
+    file << "speed " << std::setprecision(6) << speed << '\n';
+    if (!file.flush()) {
+        throw WriteFileError(path.c_str());
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+// The parameters that depend on the machine: how many ranges the parallel loops make, the bands of the Gaussian blur,
+// the tiles of TiledExecutor and the blocks of the BMP codec, as --tune picked them, with how fast this machine runs
+// the filters compared to the one Filter::GetCost() was measured on. Runs load them from a small file at startup,
+// before the first parallel loop; parameters left at 0 keep their built-in defaults. A file written on a machine with
+// another number of hardware threads is ignored.
+class Tuning {
+public:
+    // ranges a parallel loop is split into, at most the hardware threads
+    size_t threads = 0;
+    // rows or columns per band of GaussianFilter
+    size_t band_grain = 0;
+    // side of the tiles of TiledExecutor
+    size_t tile_size = 0;
+    // bytes of rows the BMP codec reads and decodes, or encodes and writes, per block
+    size_t io_block_size = 0;
+    // how many times faster than the reference machine of Filter::GetCost() this one runs the filters, for -deadline
+    long double speed = 1;
+
+    // the tuning in effect, the defaults until Set() or Load()
+    static const Tuning& Get();
+    // only while no parallel loop runs
+    static void Set(const Tuning& tuning);
+
+    // $IMAGE_PROCESSOR_TUNING, or image_processor.tuning in ~/.cache
+    static std::filesystem::path GetDefaultPath();
+
+    // puts the tuning in the file in effect; false, keeping the defaults, if there is no file, it is unreadable or it
+    // was written on another machine
+    static bool Load(const std::filesystem::path& path);
+
+    // writes the tuning to the file as "name value" lines
+    void Save(const std::filesystem::path& path) const;
+};
@@ -1,27 +1,79 @@
+#include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
 
+#include "Autotuner.h"
 #include "ImageException.h"
 #include "Image.h"
 #include "BMPio.h"
 #include "ImageRedactor.h"
+#include "Profiler.h"
+#include "Server.h"
+#include "Tuning.h"
 
 const std::string HELP = R"(Usage: image_processor <path to input image> <path to output image> [-crop <width> <height>]
                         [-gs] [-neg] [-sharp] [-edge <threshold>] [-blur <sigma>]
                         [-burn <path to image>] [-dodge <path to image>]
-                        [-chalk <sigma>] [-sketch <sigma>]
+                        [-multiply <path to image>] [-screen <path to image>]
+                        [-overlay <path to image>]
+                        [-chalk <sigma>] [-sketch <sigma>] [-scale <width> <height>]
+                        [-thumb <size>] [-rotate <degrees>] [-flipv] [-fliph]
+                        [-box <radius>] [-median <radius>] [-athresh <radius> <offset>]
+                        [-threshold <threshold>] [-blur-error <levels>] [-bpp <bits>]
+                        [-stats <path to file>] [-perf] [-max-memory <bytes>] [-explain]
+                        [-deadline <milliseconds>]
+                        [-cache <path to directory>] [-cache-size <megabytes>]
+                        [-incremental <path to directory>]
+                        [-- <path to output image> [options]]...
 
-Applies filters to the BMP image and saves the results to specified path.
+Applies filters to the BMP image and saves the results to specified path. Reads 1, 4, 8, 24 and
+32-bit images; the alpha channel of 32-bit images is kept.
+Every -- starts another output of the same image with its own options. The image is read once,
+and filters at the start of several outputs with the same arguments are applied once.
 If no arguments are given, shows this page.
 
+       image_processor --serve <path to socket>
+       image_processor --client <path to socket> <path to input image> <path to output image> [options]
+
+--serve keeps a process running that applies filters to the images named in requests sent to the
+Unix domain socket, several at a time. --client sends such a request and prints its status and
+how long every stage took; - as the input sends the image from the standard input, - as the
+output writes the result to the standard output.
+
+       image_processor --tune [<path to tuning file>]
+
+--tune times the filters and the codec on synthetic images to pick the number of threads, the
+bands of the Gaussian blur, the tiles and the blocks of the codec for this machine, and how fast
+it runs the filters for -deadline, and writes them to the file, by default the one in
+$IMAGE_PROCESSOR_TUNING or else ~/.cache/image_processor.tuning. Every other run loads that file
+at startup; one written on a machine with another number of hardware threads is ignored.
+
 Option                    Filter Name       Description
 -crop <width> <height>    Crop              Crops the image to the given width and height. The top
                                             left part of the image is used
 -gs                       Grayscale         Converts the image to grayscale
 -neg                      Negative          Converts the image to negative
 -sharp                    Sharpening        Sharpens the image
--edge <threshold>         Edge Detection    Detects edges of the image
+-edge <threshold>         Edge Detection    Detects edges of the image; auto as the threshold
+                                            picks it from the image with Otsu's method
+-threshold <threshold>    Threshold         Makes white the pixels with all channels above the
+                                            threshold, and black the rest; auto as the threshold
+                                            thresholds the luminance at the value Otsu's method
+                                            picks
 -blur <sigma>             Gaussian Blur     Blurs the image by a Gaussian function with sigma as
                                             the standard deviation of the Gaussian distribution
+-box <radius>             Box Blur          Replaces every pixel with the mean of the square of
+                                            side 2 * radius + 1 around it, in the same time for
+                                            any radius
+-median <radius>          Median            Replaces every channel of a pixel with its median over
+                                            the square of side 2 * radius + 1 around it, removing
+                                            salt-and-pepper noise; values are rounded to 8 bits
+-athresh <radius> <offset>
+                          Local Threshold   Makes white the pixels brighter than the mean of the
+                                            square of side 2 * radius + 1 around them less the
+                                            offset, and black the rest
 -burn <path to image>     Color Burn        Blends the image with the image at specified path.
                                             Darkens the base color to reflect the blend color by
                                             increasing the contrast between the two. Blending with
@@ -30,32 +82,177 @@ Option                    Filter Name       Description
                                             Brightens the base color to reflect the blend color by
                                             decreasing contrast between the two. Blending with
                                             black produces no change
+-multiply <path to image> Multiply          Blends the image with the image at specified path by
+                                            multiplying the colors. Blending with white produces
+                                            no change
+-screen <path to image>   Screen            Blends the image with the image at specified path by
+                                            multiplying the inverted colors. Blending with black
+                                            produces no change
+-overlay <path to image>  Overlay           Blends the image with the image at specified path,
+                                            multiplying the dark colors of the image and screening
+                                            the light ones
 -chalk <sigma>            Chalk Board       Makes the image look as if drawn on a chalk board
 -sketch <sigma>           Sketch            Makes the image look as if drawn with a pencil
+-scale <width> <height>   Resize            Resizes the image to the given width and height,
+                                            averaging blocks of pixels when shrinking by whole
+                                            factors and using a Lanczos kernel otherwise. Blurs
+                                            and -neg just before a downscale are applied after it,
+                                            on fewer pixels, when that gives nearly the same image;
+                                            so is -gs when shrinking by whole factors, where it
+                                            gives the same image
+-thumb <size>             Thumbnail         Shrinks the image to fit in a square with the given
+                                            side, keeping its proportions, like -scale
+-rotate <degrees>         Rotation          Turns the image clockwise by 90, 180 or 270 degrees
+-flipv                    Vertical Flip     Turns the image upside down
+-fliph                    Horizontal Flip   Mirrors the image left to right
+-blur-error <levels>                        Lets -blur, -sketch and -chalk of the output compute
+                                            wide blurs on a downscaled copy of the image, as long
+                                            as no pixel away from the borders moves by more than
+                                            the given number of levels out of 255 from the exact
+                                            blur. Blurs with a sigma of 16384 or more are always
+                                            computed exactly
+-bpp <bits>                                 Bits per pixel of the output image: 32 (with alpha,
+                                            default for images with alpha), 24 (default for the
+                                            rest), 8 (grayscale) or 1 (black and white, for masks
+                                            such as the output of -edge)
+-stats <path to file>                       Writes the minimum, maximum, mean, percentiles, Otsu
+                                            threshold and histogram of every channel and of the
+                                            luminance of the output, as written, to the file as
+                                            JSON
+-perf                                       Prints to the standard error the wall and CPU time,
+                                            cycles, instructions per cycle, last level cache misses
+                                            and the bytes per pixel they read, and branch misses of
+                                            decoding, of every filter and of every output written,
+                                            counted with perf_event_open over all threads; counters
+                                            the system does not allow are shown as n/a. Rejected by
+                                            --serve
+-max-memory <bytes>                         Keeps the estimated peak memory of the run under the
+                                            given number of bytes: the filters run on the whole
+                                            image if it fits, else in strips of the image in
+                                            memory, else in strips read from the input and written
+                                            to the output without holding the image (a single
+                                            output without -cache, -stats or -incremental, and no
+                                            filter reading the whole image). Fails if none fits.
+                                            Rejected by --serve
+-explain                                    Prints the estimated peak memory of each way of running
+                                            the filters and the one picked. Rejected by --serve
+-deadline <milliseconds>                    Estimates how long the run takes and, if it is longer,
+                                            approximates every chain with the first of these that
+                                            fits: blurs within 1 level out of 255 of the exact
+                                            ones, then within 4 levels, then all the filters on the
+                                            image downscaled by 2, 4 or 8 and scaled back up (not
+                                            for chains blending with images). Prints the
+                                            approximation picked with its estimate. Rejected by
+                                            --serve
+-cache <path to directory>                  Keeps the outputs in the directory under the hash of
+                                            the input file and the filters; outputs found there
+                                            are copied instead of made again. Rejected by --serve
+-cache-size <megabytes>                     Size of the -cache directory, beyond which the least
+                                            recently used outputs are removed (default 1024).
+                                            Rejected by --serve
+-incremental <path to directory>            Keeps the hashes of the tiles of the input and the
+                                            output in the directory; the next run with the same
+                                            filters only recomputes the tiles near changed ones.
+                                            Chains with -crop always run whole. Rejected by
+                                            --serve
 )";
 
+// asks for another path until the image is written, returns the path it was written to
+std::string Write(const Image& image, std::string filename, uint16_t bits_per_pixel) {
+    bool write_success = false;
+    while (!write_success) {
+        write_success = true;
+        try {
+            WriteBMP(filename.c_str(), image, bits_per_pixel);
+        } catch (const FileException& e) {
+            write_success = false;
+            std::cout << e.what() << "\nPlease, enter the path to output file again:" << std::endl;
+            std::cin >> filename;
+        }
+    }
+    return filename;
+}
+
+// sends the request of --client
+void RunClient(size_t argc, char** argv) {
+    if (argc < 3) {
+        throw NoOutput();
+    }
+    std::string input = argv[1];
+    std::string output = argv[2];
+    ServerMessage request(3);
+    if (input == "-") {
+        request[2].assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    } else {
+        // the server may run in another directory
+        request[0] = std::filesystem::absolute(input).string();
+    }
+    if (output != "-") {
+        request[1] = std::filesystem::absolute(output).string();
+    }
+    for (size_t i = 3; i < argc; ++i) {
+        request.emplace_back(argv[i]);
+        std::string_view option(argv[i]);
+        bool path = option == "-burn" || option == "-dodge" || option == "-multiply" || option == "-screen" ||
+                    option == "-overlay" || option == "-stats";
+        if (path && i + 1 < argc) {
+            // the server may run in another directory
+            request.push_back(std::filesystem::absolute(argv[++i]).string());
+        }
+    }
+    ServerMessage reply = Client(argv[0]).Send(request);
+    std::ostream& log = (output == "-") ? std::cerr : std::cout;
+    for (size_t i = 0; i < 2 && i < reply.size(); ++i) {
+        if (!reply[i].empty()) {
+            log << reply[i] << std::endl;
+        }
+    }
+    if (output == "-" && reply.size() > 2) {
+        std::cout.write(reply[2].data(), static_cast<std::streamsize>(reply[2].size()));
+    }
+}
+
 int main(int argc, char** argv) {
     try {
+        if (argc >= 2 && std::string(argv[1]) == "--tune") {
+            if (argc > 3) {
+                throw TooManyArguments(argv[1], 1);
+            }
+            // tunes from the defaults, so the file is not loaded
+            std::filesystem::path path = argc == 3 ? std::filesystem::path(argv[2]) : Tuning::GetDefaultPath();
+            Autotuner(std::cout)().Save(path);
+            std::cout << "tuning written to " << path.string() << std::endl;
+            return 0;
+        }
+        // before any parallel loop starts the pool of threads
+        Tuning::Load(Tuning::GetDefaultPath());
         if (argc == 1) {
             std::cout << HELP;
+        } else if (std::string(argv[1]) == "--serve") {
+            if (argc < 3) {
+                throw TooFewArguments(argv[1], 1);
+            }
+            if (argc > 3) {
+                throw TooManyArguments(argv[1], 1);
+            }
+            Server(argv[2]).Run();
+        } else if (std::string(argv[1]) == "--client") {
+            RunClient(argc - 2, argv + 2);
         } else if (argc >= 3) {
             Image image;
-            ReadBMP(argv[1], image);
             ImageRedactor redactor(image);
-            redactor.Execute(argc - 3, argv + 3);
-
-            // trying to write results
-            bool write_success = false;
-            std::string filename = argv[2];
-            while (!write_success) {
-                write_success = true;
-                try {
-                    WriteBMP(filename.c_str(), image);
-                } catch (const FileException& e) {
-                    write_success = false;
-                    std::cout << e.what() << "\nPlease, enter the path to output file again:" << std::endl;
-                    std::cin >> filename;
-                }
+            // a single output is a prefix tree with one leaf
+            redactor.ParseVariants(argc - 2, argv + 2);
+            if (redactor.IsProfiled()) {
+                // before any thread starts, so that the threads inherit the counters
+                Profiler::Instance().Enable();
+            }
+            redactor.LoadAuxiliary();
+            std::cout << redactor.PlanDeadline(argv[1]);
+            std::cout << redactor.PlanMemory(argv[1]);
+            redactor.ExecuteVariants(argv[1], Write);
+            if (redactor.IsProfiled()) {
+                std::cerr << Profiler::Instance().GetReport();
             }
         } else {
             throw NoOutput();